@@ -0,0 +1,309 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * avcprobe.c - pipelined AV/C capability probing with a disk cache
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "avcprobe.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AVC_PROBE_ITEMS 512	/* 256 descriptor types, 256 opcodes */
+#define MAXLINE 200
+
+typedef struct avc_probe_t avc_probe_t;
+
+/*
+ * An inquiry in flight. Points back to its probe, so it can be given to
+ * avc_submit as callback data.
+ */
+typedef struct avc_probe_slot_t {
+	avc_probe_t	*probe;
+	int		request;	/* 0 = free */
+	int		item;
+	int		alone;		/* sent with nothing else in flight */
+} avc_probe_slot_t;
+
+struct avc_probe_t {
+	raw1394handle_t		handle;
+	nodeid_t		node;
+	unsigned int		generation;	/* bus generation at start */
+	avc_capabilities_t	caps;
+	int			next;		/* next item to send */
+	int			retry[AVC_PROBE_IN_FLIGHT];
+	int			retries;	/* items that timed out */
+	int			window;		/* inquiries allowed in flight */
+	int			in_flight;
+	int			failures;	/* timeouts in a row, alone */
+	avc_probe_done_t	done;
+	void			*data;
+	avc_probe_slot_t	slot[AVC_PROBE_IN_FLIGHT];
+};
+
+static avc_capabilities_t *avc_cache = NULL;
+static int avc_cache_size = -1;	/* -1 = not read yet */
+
+/*
+ * RETURNS:	the name of the cache file or NULL if there is no $HOME
+ */
+static char *avc_cache_filename(void) {
+	static char filename[MAXLINE];
+	char *home = getenv("HOME");
+
+	if (home == NULL) return NULL;
+	snprintf(filename, sizeof(filename), "%s/%s", home,
+		AVC_PROBE_CACHE_FILE);
+	return filename;
+}
+
+static void avc_bitmap_to_hex(unsigned char *bitmap, char *hex) {
+	int i;
+
+	for (i=0; i < 32; i++) sprintf(hex + 2*i, "%02x", bitmap[i]);
+}
+
+static int avc_hex_to_bitmap(char *hex, unsigned char *bitmap) {
+	unsigned int byte;
+	int i;
+
+	if (strlen(hex) != 64) return -1;
+	for (i=0; i < 32; i++) {
+		if (sscanf(hex + 2*i, "%2x", &byte) != 1) return -1;
+		bitmap[i] = byte;
+	}
+	return 0;
+}
+
+static void avc_cache_add(avc_capabilities_t *caps) {
+	avc_cache = realloc(avc_cache, (avc_cache_size+1)
+		* sizeof(avc_capabilities_t));
+	if (avc_cache == NULL) fatal("out of memory!");
+	avc_cache[avc_cache_size++] = *caps;
+}
+
+/*
+ * Read in the cache file on first use. One line per probed subunit:
+ * key_hi key_lo subunit descriptor-bitmap opcode-bitmap
+ */
+static void avc_cache_load(void) {
+	char s[MAXLINE+1], descriptors[MAXLINE+1], opcodes[MAXLINE+1];
+	avc_capabilities_t caps;
+	char *filename;
+	FILE *file;
+
+	if (avc_cache_size >= 0) return;
+	avc_cache_size = 0;
+	if ((filename = avc_cache_filename()) == NULL) return;
+	if ((file = fopen(filename, "r")) == NULL) return;
+	while (fgets(s, MAXLINE+1, file) != NULL) {
+		if (s[0] == '#') continue;
+		if (sscanf(s, "%x %x %x %200s %200s", &caps.key_hi,
+			&caps.key_lo, &caps.subunit, descriptors, opcodes) != 5
+			|| avc_hex_to_bitmap(descriptors, caps.descriptors) < 0
+			|| avc_hex_to_bitmap(opcodes, caps.opcodes) < 0) {
+			DEBUG_AVC fprintf(stderr, "%s: bad line: %s",
+				filename, s);
+			continue;
+		}
+		avc_cache_add(&caps);
+	}
+	fclose(file);
+	DEBUG_AVC fprintf(stderr, "%s: %i AV/C capability entries\n",
+		filename, avc_cache_size);
+}
+
+static avc_capabilities_t *avc_cache_lookup(quadlet_t key_hi,
+	quadlet_t key_lo, quadlet_t subunit) {
+
+	int i;
+
+	avc_cache_load();
+	for (i=0; i < avc_cache_size; i++)
+		if (avc_cache[i].key_hi == key_hi
+			&& avc_cache[i].key_lo == key_lo
+			&& avc_cache[i].subunit == subunit)
+			return &avc_cache[i];
+	return NULL;
+}
+
+static void avc_cache_store(avc_capabilities_t *caps) {
+	char descriptors[65], opcodes[65];
+	char *filename;
+	FILE *file;
+
+	avc_cache_add(caps);
+	if ((filename = avc_cache_filename()) == NULL) return;
+	if ((file = fopen(filename, "a")) == NULL) {
+		perror(filename);
+		return;
+	}
+	avc_bitmap_to_hex(caps->descriptors, descriptors);
+	avc_bitmap_to_hex(caps->opcodes, opcodes);
+	fprintf(file, "%08x %08x %08x %s %s\n", caps->key_hi, caps->key_lo,
+		caps->subunit, descriptors, opcodes);
+	fclose(file);
+}
+
+/*
+ * Finish a probe: report the result and free it. Inquiries still in
+ * flight are cancelled.
+ */
+static void avc_probe_finish(avc_probe_t *probe, int ok) {
+	int i;
+
+	if (ok && raw1394_get_generation(probe->handle) != probe->generation) {
+		/* The node may be a different device now */
+		DEBUG_AVC fprintf(stderr, "AV/C probe of node %d interrupted "
+			"by a bus reset\n", probe->node);
+		ok = 0;
+	}
+	for (i=0; i < AVC_PROBE_IN_FLIGHT; i++)
+		if (probe->slot[i].request != 0)
+			avc_cancel(probe->slot[i].request);
+	if (ok) avc_cache_store(&probe->caps);
+	probe->done(probe->node, ok ? &probe->caps : NULL, probe->data);
+	free(probe);
+}
+
+static void avc_probe_response(nodeid_t node, quadlet_t *response, int len,
+	void *data);
+
+/*
+ * Keep the window of inquiries full. Finishes the probe when all items
+ * are answered.
+ */
+static void avc_probe_fill(avc_probe_t *probe) {
+	avc_probe_slot_t *slot;
+	quadlet_t command;
+	int i, item;
+
+	while (probe->in_flight < probe->window
+		&& (probe->retries > 0 || probe->next < AVC_PROBE_ITEMS)) {
+		for (i=0; probe->slot[i].request != 0; i++);
+		slot = &probe->slot[i];
+		item = (probe->retries > 0) ? probe->retry[--probe->retries]
+			: probe->next++;
+		if (item < 256) {
+			command = AVC_CTYPE_SPECIFIC_INQUIRY
+				| probe->caps.subunit
+				| AVC_COMMAND_OPEN_DESCRIPTOR | item;
+		} else {
+			command = AVC_CTYPE_GENERAL_INQUIRY
+				| probe->caps.subunit
+				| (item - 256) << 8 | 0xFF;
+		}
+		slot->item = item;
+		slot->alone = (probe->in_flight == 0);
+		slot->request = avc_submit(probe->handle, probe->node,
+			&command, 1, 0, avc_probe_response, slot);
+		if (slot->request < 0) {
+			slot->request = 0;
+			probe->retry[probe->retries++] = item;
+			if (probe->in_flight == 0) avc_probe_finish(probe, 0);
+			/* Otherwise try again when a response frees a slot */
+			return;
+		}
+		probe->in_flight++;
+	}
+	if (probe->in_flight == 0) avc_probe_finish(probe, 1);
+}
+
+static void avc_probe_response(nodeid_t node, quadlet_t *response, int len,
+	void *data) {
+
+	avc_probe_slot_t *slot = (avc_probe_slot_t *) data;
+	avc_probe_t *probe = slot->probe;
+	int item = slot->item;
+
+	slot->request = 0;
+	probe->in_flight--;
+
+	if (response == NULL && (avc_is_resetting()
+		|| raw1394_get_generation(probe->handle) != probe->generation)) {
+		/* Not the device's fault, and the phyID may be another's now */
+		DEBUG_AVC fprintf(stderr, "AV/C probe of node %d interrupted "
+			"by a bus reset\n", node);
+		avc_probe_finish(probe, 0);
+		return;
+	} else if (response == NULL) {
+		/*
+		 * The device may not queue commands, go on one at a time.
+		 * Only give up when it does not answer those either.
+		 */
+		probe->window = 1;
+		probe->retry[probe->retries++] = item;
+		if (slot->alone && ++probe->failures >= AVC_PROBE_RETRIES) {
+			DEBUG_AVC fprintf(stderr, "AV/C probe of node %d "
+				"failed\n", node);
+			avc_probe_finish(probe, 0);
+			return;
+		}
+	} else {
+		probe->failures = 0;
+		if (AVC_MASK_RESPONSE(response[0]) == AVC_RESPONSE_IMPLEMENTED) {
+			if (item < 256)
+				probe->caps.descriptors[item >> 3]
+					|= 1 << (item & 7);
+			else
+				probe->caps.opcodes[(item-256) >> 3]
+					|= 1 << (item & 7);
+		}
+	}
+	avc_probe_fill(probe);
+}
+
+void avc_probe(raw1394handle_t handle, nodeid_t node, Rom_info *rom_info,
+	quadlet_t subunit, avc_probe_done_t done, void *data) {
+
+	avc_capabilities_t *caps;
+	avc_probe_t *probe;
+	quadlet_t key_hi, key_lo;
+	int i;
+
+	if (rom_info->model_id != 0) {
+		key_hi = rom_info->vendor_id;
+		key_lo = rom_info->model_id;
+	} else {
+		key_hi = rom_info->guid_hi;
+		key_lo = rom_info->guid_lo;
+	}
+	if ((caps = avc_cache_lookup(key_hi, key_lo, subunit)) != NULL) {
+		DEBUG_AVC fprintf(stderr, "AV/C capabilities of node %d "
+			"from cache\n", node);
+		done(node, caps, data);
+		return;
+	}
+
+	probe = (avc_probe_t *) calloc(1, sizeof(avc_probe_t));
+	if (probe == NULL) fatal("out of memory!");
+	probe->handle = handle;
+	probe->node = node;
+	probe->generation = raw1394_get_generation(handle);
+	probe->caps.key_hi = key_hi;
+	probe->caps.key_lo = key_lo;
+	probe->caps.subunit = subunit;
+	probe->window = AVC_PROBE_IN_FLIGHT;
+	probe->done = done;
+	probe->data = data;
+	for (i=0; i < AVC_PROBE_IN_FLIGHT; i++)
+		probe->slot[i].probe = probe;
+
+	DEBUG_AVC fprintf(stderr, "Probing AV/C capabilities of node %d\n",
+		node);
+	avc_probe_fill(probe);
+}
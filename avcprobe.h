@@ -0,0 +1,71 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * avcprobe.h - pipelined AV/C capability probing with a disk cache
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __AVCPROBE_H__
+#define __AVCPROBE_H__
+#include "simpleavc.h"
+#include "rominfo.h"
+
+#define AVC_PROBE_IN_FLIGHT 8	/* inquiries in flight per device */
+#define AVC_PROBE_RETRIES 3	/* timeouts in a row before giving up */
+#define AVC_PROBE_CACHE_FILE ".gscanbus-avc"	/* in $HOME */
+
+/*
+ * What a subunit of a device model implements, one bit per descriptor
+ * type and per opcode.
+ */
+typedef struct avc_capabilities_t {
+	quadlet_t	key_hi;		/* vendor_id, guid_hi if no model_id */
+	quadlet_t	key_lo;		/* model_id, guid_lo if no model_id */
+	quadlet_t	subunit;	/* subunit type and ID */
+	unsigned char	descriptors[32];	/* OPEN DESCRIPTOR accepted */
+	unsigned char	opcodes[32];		/* GENERAL INQUIRY IMPLEMENTED */
+} avc_capabilities_t;
+
+#define AVC_CAPABLE(bitmap, n) ((bitmap)[(n) >> 3] & (1 << ((n) & 7)))
+
+/*
+ * Called when a probe has finished.
+ * IN:		node:	the phyisical ID of the node
+ *		caps:	the capabilities, NULL if the probe failed. Only
+ *			valid during the call.
+ *		data:	as given to avc_probe
+ */
+typedef void (*avc_probe_done_t)(nodeid_t node, avc_capabilities_t *caps,
+	void *data);
+
+/*
+ * Find out which descriptors and opcodes a subunit implements. The result
+ * is cached on disk per model (per GUID if the ROM has no model_id), so
+ * every model is probed only once; otherwise the inquiries are sent with
+ * avc_submit, several at a time, and done is called when all are answered.
+ * IN:		handle:		the libraw1394 handle
+ *		node:		the phyisical ID of the node
+ *		rom_info:	the configuration ROM of the node
+ *		subunit:	subunit type and ID, e.g.
+ *				AVC_SUBUNIT_TYPE_UNIT | AVC_SUBUNIT_ID_IGNORE
+ *		done:		called with the result, at once on a cache hit
+ *				or if no inquiry can be sent
+ *		data:		passed to done
+ */
+void avc_probe(raw1394handle_t handle, nodeid_t node, Rom_info *rom_info,
+	quadlet_t subunit, avc_probe_done_t done, void *data);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * checkSyntheticBus.c - make check for synthetic buses and snapshots
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include "syntheticBus.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_FILE "checkSyntheticBus.gsbs"
+
+static int failures = 0;
+
+/*
+ * Report a failure.
+ * RETURNS:	-1
+ */
+static int fail(int shape, int nnodes, int maxPorts, const char *what)
+{
+	fprintf(stderr, "shape %d, %d nodes, %d ports: %s\n", shape, nnodes,
+		maxPorts, what);
+	failures++;
+	return -1;
+}
+
+/*
+ * Check the decoded parent/child structure against the port states of the
+ * self-IDs and against the shape that was asked for.
+ * RETURNS:	0 if the tree is fine
+ */
+static int checkTree(TopologyTree *t, int shape, int nnodes, int maxPorts)
+{
+	int i, k, p, nports, nparent, nchild, fanout;
+	unsigned char status;
+
+	if (t->nodeCount != nnodes) return fail(shape, nnodes, maxPorts,
+		"wrong node count");
+	if (t->root != nnodes-1 || t->parent[t->root] != NO_NODE)
+		return fail(shape, nnodes, maxPorts, "wrong root");
+
+	for (i=0; i < nnodes; i++) {
+		if (t->selfid[i][0].packetZero.phyID != i)
+			return fail(shape, nnodes, maxPorts, "wrong phyID");
+		nports = nparent = nchild = 0;
+		for (p=0; p < MAX_CHILDS; p++) {
+			status = selfid_port_status(t->selfid[i], p);
+			if (status != SELFID_PORT_NONE) nports = p+1;
+			if (status == SELFID_PORT_PARENT) nparent++;
+			if (status == SELFID_PORT_CHILD) nchild++;
+		}
+		if (nports > maxPorts)
+			return fail(shape, nnodes, maxPorts, "too many ports");
+		if (nparent != (i != t->root) || nchild != t->nchilds[i])
+			return fail(shape, nnodes, maxPorts,
+				"ports do not match the tree");
+		if (i != t->root && t->parent[i] <= i)
+			return fail(shape, nnodes, maxPorts,
+				"parent below child");
+		for (k=0; k < t->nchilds[i]; k++)
+			if (t->parent[t->child[t->firstChild[i]+k]] != i)
+				return fail(shape, nnodes, maxPorts,
+					"child with another parent");
+	}
+
+	switch (shape) {
+		case SYNTH_SHAPE_CHAIN:
+			for (i=0; i < nnodes; i++)
+				if (t->nchilds[i] > 1) return fail(shape, nnodes,
+					maxPorts, "chain branches");
+			break;
+		case SYNTH_SHAPE_STAR:
+		case SYNTH_SHAPE_BALANCED:
+			fanout = maxPorts < nnodes-1 ? maxPorts : nnodes-1;
+			if (t->nchilds[t->root] != fanout)
+				return fail(shape, nnodes, maxPorts,
+					"root does not fan out");
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Save a tree as a snapshot, load it back and compare.
+ */
+static void checkSnapshot(TopologyTree *t, int shape, int nnodes, int maxPorts)
+{
+	Snapshot *snapshot;
+	TopologyTree *u;
+	Rom_info *a, *b;
+	int i;
+
+	if (writeSnapshot(SNAPSHOT_FILE, t)) {
+		perror(SNAPSHOT_FILE);
+		fail(shape, nnodes, maxPorts, "snapshot not written");
+		return;
+	}
+	if ((snapshot = openSnapshot(SNAPSHOT_FILE)) == NULL) {
+		fail(shape, nnodes, maxPorts, "snapshot not opened");
+		return;
+	}
+	u = spawnSnapshotTopologyTree(snapshot);
+	if (u == NULL || u->nodeCount != t->nodeCount
+		|| u->generation != t->generation
+		|| u->timestamp != t->timestamp) {
+		fail(shape, nnodes, maxPorts, "snapshot header differs");
+	} else {
+		for (i=0; i < nnodes; i++) {
+			a = &t->rom_info[i];
+			b = &u->rom_info[i];
+			if (memcmp(u->rawSelfId[i], t->rawSelfId[i],
+				sizeof(t->rawSelfId[i]))
+				|| u->parent[i] != t->parent[i]) {
+				fail(shape, nnodes, maxPorts,
+					"snapshot self-IDs differ");
+				break;
+			}
+			if (a->image_length != b->image_length
+				|| (a->image_length && memcmp(a->image,
+				b->image, 4 * a->image_length))
+				|| a->guid_hi != b->guid_hi
+				|| a->guid_lo != b->guid_lo) {
+				fail(shape, nnodes, maxPorts,
+					"snapshot ROMs differ");
+				break;
+			}
+		}
+	}
+	if (u != NULL) freeTopologyTree(u);
+	closeSnapshot(snapshot);
+}
+
+/*
+ * Check the balanced 3 port maps of generateTestTopologyMap like the buses.
+ * RETURNS:	the number of maps checked
+ */
+static int checkTestTopologyMap(void)
+{
+	RAW1394topologyMap *map, *again;
+	TopologyTree *t;
+	int nnodes, count = 0;
+
+	if (generateTestTopologyMap(1, 0) != NULL
+		|| generateTestTopologyMap(1, MAX_NODES) != NULL)
+		fail(SYNTH_SHAPE_BALANCED, 0, 3, "test map out of range");
+	for (nnodes=1; nnodes < MAX_NODES; nnodes++) {
+		map = generateTestTopologyMap(nnodes, nnodes);
+		again = generateTestTopologyMap(nnodes, nnodes);
+		if (map == NULL || again == NULL) {
+			fail(SYNTH_SHAPE_BALANCED, nnodes, 3, "no test map");
+			free(map);
+			free(again);
+			continue;
+		}
+		if (map->length != map->selfIdCount + 2
+			|| map->nodeCount != nnodes)
+			fail(SYNTH_SHAPE_BALANCED, nnodes, 3,
+				"wrong test map length");
+		if (memcmp(map->selfIdPacket, again->selfIdPacket,
+			map->selfIdCount * sizeof(map->selfIdPacket[0])))
+			fail(SYNTH_SHAPE_BALANCED, nnodes, 3,
+				"test map differs for the same seed");
+		t = spawnTopologyTreeShape(map);
+		if (t == NULL) {
+			fail(SYNTH_SHAPE_BALANCED, nnodes, 3,
+				"test map not decoded");
+		} else {
+			checkTree(t, SYNTH_SHAPE_BALANCED, nnodes, 3);
+			freeTopologyTree(t);
+		}
+		free(map);
+		free(again);
+		count++;
+	}
+	return count;
+}
+
+int main(void)
+{
+	SyntheticBus *bus;
+	TopologyTree *t;
+	int shape, nnodes, maxPorts, count = 0;
+
+	for (shape=SYNTH_SHAPE_CHAIN; shape <= SYNTH_SHAPE_BALANCED; shape++)
+	for (maxPorts=1; maxPorts <= SYNTH_MAX_PORTS; maxPorts++)
+	for (nnodes=1; nnodes < MAX_NODES; nnodes++) {
+		bus = generateSyntheticBus(nnodes * 31 + maxPorts, nnodes,
+			shape, maxPorts);
+		/* Only a single port can not pass a bus on */
+		if ((bus == NULL) != (nnodes > 2 && maxPorts < 2)) {
+			fail(shape, nnodes, maxPorts, bus == NULL ?
+				"no bus generated" : "impossible bus generated");
+		}
+		if (bus == NULL) continue;
+		t = spawnSyntheticTopologyTree(bus);
+		if (t == NULL) {
+			fail(shape, nnodes, maxPorts, "self-IDs not decoded");
+		} else {
+			if (checkTree(t, shape, nnodes, maxPorts) == 0)
+				checkSnapshot(t, shape, nnodes, maxPorts);
+			freeTopologyTree(t);
+		}
+		free(bus);
+		count++;
+	}
+	unlink(SNAPSHOT_FILE);
+	count += checkTestTopologyMap();
+
+	printf("%d buses checked, %d failures\n", count, failures);
+	return failures != 0;
+}
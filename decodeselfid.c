@@ -229,6 +229,33 @@ char *decode_all_ports_status(SelfIdPacket_t *selfid) {
 	return buf;
 }
 
+unsigned char selfid_port_status(SelfIdPacket_t *selfid, int port) {
+	int packet, i;
+
+	switch (port) {
+		case 0: return selfid->packetZero.port0;
+		case 1: return selfid->packetZero.port1;
+		case 2: return selfid->packetZero.port2;
+	}
+	if (port < 0 || port >= 3+3*8) return SELFID_PORT_NONE;
+	packet = 1 + (port-3) / 8;
+	if (selfid[0].packetZero.morePackets == 0) return SELFID_PORT_NONE;
+	for (i=1; i<packet; i++)
+		if (selfid[i].packetMore.morePackets == 0)
+			return SELFID_PORT_NONE;
+	selfid += packet;
+	switch ((port-3) % 8) {
+		case 0: return selfid->packetMore.portA;
+		case 1: return selfid->packetMore.portB;
+		case 2: return selfid->packetMore.portC;
+		case 3: return selfid->packetMore.portD;
+		case 4: return selfid->packetMore.portE;
+		case 5: return selfid->packetMore.portF;
+		case 6: return selfid->packetMore.portG;
+		default: return selfid->packetMore.portH;
+	}
+}
+
 void print_selfid(SelfIdPacket_t *selfid) {
 	printf("Physical ID:\t%i (0x%x)\n",selfid->packetZero.phyID,selfid->packetZero.phyID);
 	printf("  Link active:\t%s\n",yes_no(selfid->packetZero.linkActive));
@@ -99,6 +99,15 @@ char *decode_port_status(unsigned char i);
 
 char *decode_all_ports_status(SelfIdPacket_t *selfid);
 
+/*
+ * Get the status of a single port from a decoded (multi packet) self-ID
+ * IN:		selfid:	the decoded self-ID packets of one node
+ *		port:	port number, 0 to 26
+ * RETURNS:	one of SELFID_PORT_CHILD, SELFID_PORT_PARENT, etc.
+ *		SELFID_PORT_NONE for ports beyond the last self-ID packet
+ */
+unsigned char selfid_port_status(SelfIdPacket_t *selfid, int port);
+
 void print_selfid(SelfIdPacket_t *selfid);
 
 #endif
@@ -0,0 +1,150 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * gapCount.c - gap count optimization via PHY configuration packets
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "gapCount.h"
+
+/* IEEE 1394a table E-1, indexed by the number of hops */
+static const unsigned char gapCountTable[] = {
+	63, 5, 7, 8, 10, 13, 16, 18, 21, 24, 26, 29, 32, 35, 37, 40
+};
+
+/* PHY base rate used for the gap timings in MHz */
+#define BASE_RATE 98.304
+#define CYCLE_TIME 125.0
+
+static int pendingGapCount = -1;
+static int pendingOldGapCount;
+static unsigned int pendingGeneration;
+
+int gapCountForHops(int hops)
+{
+	if (hops < 0 || hops >= (int) sizeof(gapCountTable)) return GAP_COUNT_MAX;
+	return gapCountTable[hops];
+}
+
+int gapCountCurrent(TopologyTree *topologyTree)
+{
+	int i, gapCount;
+
+	gapCount = topologyTree->selfid[0][0].packetZero.gapCount;
+	for (i=1; i < topologyTree->nodeCount; i++)
+		if (topologyTree->selfid[i][0].packetZero.gapCount != gapCount)
+			return -1;
+	return gapCount;
+}
+
+int gapCountOptimal(TopologyTree *topologyTree)
+{
+	return gapCountForHops(speedMapMaxHops(getSpeedMap(topologyTree)));
+}
+
+int gapCountMixedBus(TopologyTree *topologyTree)
+{
+	int i, legacy = 0, beta = 0;
+
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		if (topologyTree->selfid[i][0].packetZero.phySpeed == 3) beta++;
+		else legacy++;
+	}
+	return legacy && beta;
+}
+
+/*
+ * subaction_gap = (27 + 16 * gap_count) / BASE_RATE
+ * arb_reset_gap = (51 + 32 * gap_count) / BASE_RATE
+ */
+double gapCountCycleOverhead(int gapCount)
+{
+	return ((27 + 16*gapCount) + (51 + 32*gapCount)) / BASE_RATE;
+}
+
+int gapCountReport(TopologyTree *topologyTree, char *buf, int len)
+{
+	int hops, current, optimal;
+	double before, after;
+
+	if (gapCountMixedBus(topologyTree)) {
+		snprintf(buf, len, "The bus contains both 1394a and 1394b PHYs.\n"
+			"Refusing to change the gap count.\n");
+		return -1;
+	}
+	hops = speedMapMaxHops(getSpeedMap(topologyTree));
+	current = gapCountCurrent(topologyTree);
+	optimal = gapCountForHops(hops);
+	before = gapCountCycleOverhead(current < 0 ? GAP_COUNT_MAX : current);
+	after = gapCountCycleOverhead(optimal);
+	snprintf(buf, len, "Maximum hop count: %i\n"
+		"Current gap count: %i%s\n"
+		"Optimal gap count: %i\n"
+		"Gap overhead per cycle: %.2f us -> %.2f us\n"
+		"Estimated bandwidth gained: %.1f%% of each cycle\n",
+		hops, current, current < 0 ? " (inconsistent)" : "",
+		optimal, before, after, (before - after) * 100.0 / CYCLE_TIME);
+	return optimal;
+}
+
+int gapCountApply(raw1394handle_t handle, TopologyTree *topologyTree,
+	int dryRun, char *buf, int len)
+{
+	int optimal, used;
+
+	optimal = gapCountReport(topologyTree, buf, len);
+	if (optimal < 0) return -1;
+	used = strlen(buf);
+	if (dryRun) {
+		snprintf(buf + used, len - used, "Dry run, nothing sent.\n");
+		return 0;
+	}
+	if (send_phy_config(handle, -1, optimal) < 0) {
+		snprintf(buf + used, len - used,
+			"Sending the PHY configuration packet failed.\n");
+		return -1;
+	}
+	pendingGapCount = optimal;
+	pendingOldGapCount = gapCountCurrent(topologyTree);
+	pendingGeneration = topologyTree->generation;
+	raw1394_reset_bus(handle);
+	snprintf(buf + used, len - used, "PHY configuration packet sent, "
+		"bus reset initiated.\n");
+	return 0;
+}
+
+int gapCountVerify(TopologyTree *topologyTree, char *buf, int len)
+{
+	int current, expected;
+
+	if (pendingGapCount < 0 || topologyTree == NULL) return 0;
+	if (topologyTree->generation == pendingGeneration) return 0;
+	expected = pendingGapCount;
+	pendingGapCount = -1;
+	current = gapCountCurrent(topologyTree);
+	if (current != expected) {
+		snprintf(buf, len, "Gap count verification failed: expected %i,"
+			" self-IDs report %i.\n", expected, current);
+		return -1;
+	}
+	snprintf(buf, len, "Gap count %i verified in generation %u.\n"
+		"Gap overhead per cycle: %.2f us -> %.2f us\n",
+		current, topologyTree->generation,
+		gapCountCycleOverhead(pendingOldGapCount < 0 ? GAP_COUNT_MAX
+			: pendingOldGapCount),
+		gapCountCycleOverhead(current));
+	return 1;
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * gapCount.h - gap count optimization via PHY configuration packets
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GAPCOUNT_H__
+#define __GAPCOUNT_H__
+#include "topologyTree.h"
+#include "speedMap.h"
+#include "raw1394util.h"
+
+#define GAP_COUNT_MAX 63
+
+/*
+ * Look up the optimal gap count for a bus diameter in the IEEE 1394a table.
+ * IN:		hops:	maximum number of hops between any two nodes
+ * RETURNS:	the gap count
+ */
+int gapCountForHops(int hops);
+
+/*
+ * RETURNS:	the gap count reported in the self-IDs, -1 if the nodes do
+ *		not agree on one
+ */
+int gapCountCurrent(TopologyTree *topologyTree);
+
+/*
+ * RETURNS:	the optimal gap count for the current tree
+ */
+int gapCountOptimal(TopologyTree *topologyTree);
+
+/*
+ * Check for a mix of 1394a and 1394b PHYs. 1394b PHYs report a speed code
+ * of 3 in their self-IDs, legacy PHYs S100 to S400.
+ * RETURNS:	non zero if the bus is mixed
+ */
+int gapCountMixedBus(TopologyTree *topologyTree);
+
+/*
+ * Estimate the idle time a gap count costs per isochronous cycle, i.e. one
+ * subaction gap plus one arbitration reset gap.
+ * RETURNS:	the time in microseconds
+ */
+double gapCountCycleOverhead(int gapCount);
+
+/*
+ * Describe what optimizing the gap count would do.
+ * IN:		topologyTree:	the current tree
+ * 		buf, len:	buffer for the report
+ * RETURNS:	the optimal gap count, -1 if the bus must not be touched
+ */
+int gapCountReport(TopologyTree *topologyTree, char *buf, int len);
+
+/*
+ * Send a PHY configuration packet with the optimal gap count and reset the
+ * bus. In dry run mode nothing is sent. The expected gap count is
+ * remembered and checked by gapCountVerify after the reset.
+ * RETURNS:	0 on success, -1 on error or refusal
+ */
+int gapCountApply(raw1394handle_t handle, TopologyTree *topologyTree,
+	int dryRun, char *buf, int len);
+
+/*
+ * Verify the self-IDs of a new generation against a previously applied
+ * gap count.
+ * RETURNS:	0 if nothing was pending, 1 if the gap count was verified,
+ *		-1 if the nodes do not report the expected gap count. The
+ *		result is described in buf.
+ */
+int gapCountVerify(TopologyTree *topologyTree, char *buf, int len);
+
+#endif
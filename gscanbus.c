@@ -24,32 +24,48 @@
 
 #include "raw1394util.h"
 #include "simpleavc.h"
+#include "avcprobe.h"
 #include "topologyMap.h"
 #include "rominfo.h"
 #include "topologyTree.h"
 #include "decodeselfid.h"
 #include "menues.h"
+#include "gapCount.h"
+#include "rootAdvisor.h"
+#include "snapshot.h"
+#include "scanWorker.h"
 #include "debug.h"
 #include "icons.h"
+#include "treeLayout.h"
 #include <sys/types.h>
 #include <gtk/gtk.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <math.h>
+#include <poll.h>
 
 #define FONTNAME "-*-helvetica-*-*-*-*-12-*-*-*-*-*-*-*"
-#define FONTHEIGHT 12
-
-#define NODEWIDTH 48	/* Pixmaps should not exceed this size */
-#define NODEHEIGHT 48
-
 #define SETLINEWIDTH(gc, width) gdk_gc_set_line_attributes(gc, width, GDK_LINE_SOLID, GDK_CAP_NOT_LAST, GDK_JOIN_MITER);
 
+#define ZOOM_MIN 0.1
+#define ZOOM_MAX 4.0
+#define ZOOM_STEP 1.25	/* per click of the scroll wheel */
+#define LOD_TEXT 0.7	/* below this zoom speed and label are left out */
+#define LOD_DOTS 0.4	/* below this zoom nodes are drawn as dots */
+
 raw1394handle_t handle;		/* Global = dangerous (threading issues) */
 TopologyTree *topologyTree;	/* Global for mouse click detection */
 GtkWidget *drawing_area;	/* Global for use by bus reset handler */
-int repaintCountdown = 0;
+unsigned int settleWindow = 200;	/* ms without a reset before a rescan */
+unsigned int settleGeneration;
+guint settleTimer = 0;
+Snapshot *snapshot = NULL;	/* Shown instead of the bus if not NULL */
+double viewZoom = 1.0;		/* window pixels per layout pixel */
+double viewX = 0, viewY = 0;	/* window position of the layout origin */
+int panning = 0;		/* dragging the view */
+double panX, panY;		/* pointer position of the last drag event */
 
 //static GdkPixmap *pixmap = NULL;
 
@@ -62,71 +78,34 @@ const char not_loaded[] = "\
 This probably means that you don't have raw1394 support in the kernel or that\
 you haven't loaded the raw1394 module.\n";
 
+const char usage[] = "\
+Usage: gscanbus [-p port] [-s settle milliseconds] [-v[debug level]]\n";
+
 /*---------------------------------------------------------------------------
  * Drawing routines
  *---------------------------------------------------------------------------*/
 
 /*
- * Draw a line for the topology Tree.
- * IN:	drawable:	The GDK drawing Area to draw into
- * 	gc:		The GDK Graphics Context to use
- * 	x1:		x position of beginning of line
- * 	y1:		y position of beginning of line
- * 	x2:		x position of end of line
- * 	y2:		y position of end of line
- * 	node:		The current node
- * 	child:		The child node to draw the line to
- * 	col_new:	The color to use for the line
- * 	col_old:	The color to restore when finished
+ * Draw the visible part of a topology tree from its layout. The user space
+ * of cr is the layout, transformed to the window by the view. Detail is
+ * reduced when zoomed out.
+ * IN:	cr:		The cairo context of the back pixmap
+ * 	layout:		The layout of the tree
+ * 	zoom:		The zoom factor of the view
+ * 	visible:	The part of the layout that is shown in the window
  */
-void drawTopologyLine(cairo_t *cr,
-		int x1, int y1, int x2, int y2, TopologyTree *node,
-		TopologyTree *child, GdkColor *col_new)
+void drawTreeLayout(cairo_t *cr, TreeLayout *layout, double zoom,
+	GdkRectangle *visible)
 {
-	cairo_set_line_width(cr, (MIN(node->selfid[0].packetZero.phySpeed,
-			child->selfid[0].packetZero.phySpeed)+1)*2);
-	gdk_cairo_set_source_color(cr, col_new);
-	cairo_move_to(cr, x1, y1);
-	cairo_line_to(cr, x2, y2);
-	cairo_stroke(cr);
-}
-
-void chooseLabel(Rom_info *rom_info, TopologyTree *node, char *label) 
-{
-	/* Use rom_info->label if it contains something meaningful */
-	if (rom_info->label != NULL && strcmp(rom_info->label, "Unknown")) {
-		strcpy(node->label, rom_info->label);
-	/* Use calculated label otherwise, if it exists */
-	} else if (label != NULL) {
-		strcpy(node->label, label);
-	} else {
-		strcpy(node->label, "Unknown");
-	}
-
-}
-
-/*
- * Draw a topology Tree.
- * IN:	drawable:	The GDK drawing Area to draw into
- * 	window:		The window to get various default values from
- * 	gc:		The GDK Graphics Context to use
- * 	node:		The topologyTree or subTree
- * 	myPhyID:	Physical ID of the host, for highlighting
- * 	left:		left offset to begin drawing
- * 	width:		width of drawing area
- * 	level:		depth of the current subTree in respect to the root
- */
-void drawTopologyTree(cairo_t *cr,
-	    	TopologyTree *node, int myPhyID, int left, int width, int level) 
-{
-    	int nodewidth = NODEWIDTH;
-    	int nodeheight = NODEHEIGHT;
+	int i, count;
 	int xpmwidth;
 	int xpmheight;
-    	GdkPixbuf *xpm_node;
-    	TopologyTree *child;
-	Rom_info rom_info;
-	char *label = NULL;
+	int ascent, width, textWidth;
+	double dx, dy, tx, ty, lx = 0, ly;
+	unsigned char nodes[MAX_NODES];
+	LayoutNode *ln;
+	LayoutEdge *edge;
+	cairo_surface_t *icon, *text;
 
 	/* All static variables are only loaded once and then reused */
     	static GdkColormap *colormap;
@@ -149,225 +128,343 @@ void drawTopologyTree(cairo_t *cr,
 		col_lines = col_arc;
 	}
 
-	initIcons();
-
-	rom_info = node->rom_info;
-
-	/* Choose label and icon */
-	chooseIcon(&rom_info, &xpm_node, &label);
-	chooseLabel(&rom_info, node, label);
-
-	/* Recursively draw rest of tree */
-	if (numberOfChilds(node) == 0) {
-		/* We are a leaf */
-	} else if (numberOfChilds(node) == 1) {
-		/* Draw one child directly beneath us */
-		child = getNthChild(node,1);
-		drawTopologyLine(cr,
-			left+width/2, level*nodeheight*2+nodeheight/2,
-			left+width/2, (level+1)*nodeheight*2+nodeheight/2,
-			node, child, col_lines);
-		drawTopologyTree(cr, child, myPhyID,
-			left, width, level+1);
-	} else if (numberOfChilds(node) == 2) {
-		/* Draw two childs left and right beneath us */
-		child = getNthChild(node,1);
-		drawTopologyLine(cr,
-			left+width/2, level*nodeheight*2+nodeheight/2,
-			left+width/4, (level+1)*nodeheight*2+nodeheight/2,
-			node, child, col_lines);
-		drawTopologyTree(cr, child, myPhyID,
-			left, width/2, level+1);
-		child = getNthChild(node,2);
-		drawTopologyLine(cr,
-			left+width/2, level*nodeheight*2+nodeheight/2,
-			left+width/2+width/4,
-			(level+1)*nodeheight*2+nodeheight/2,
-			node, child, col_lines);
-		drawTopologyTree(cr, child, myPhyID,
-			left+width/2, width/2, level+1);
-	} else if (numberOfChilds(node) == 3) {
-		/* Draw three childs left, right and directly beneath us */
-		child = getNthChild(node,1);
-		drawTopologyLine(cr,
-			left+width/2, level*nodeheight*2+nodeheight/2,
-			left+width/6, (level+1)*nodeheight*2+nodeheight/2,
-			node, child, col_lines);
-		drawTopologyTree(cr, child, myPhyID,
-			left, width/3, level+1);
-		child = getNthChild(node,2);
-		drawTopologyLine(cr,
-			left+width/2, level*nodeheight*2+nodeheight/2,
-			left+width/2, (level+1)*nodeheight*2+nodeheight/2,
-			node, child, col_lines);
-		drawTopologyTree(cr, child, myPhyID,
-			left, width, level+1);
-		child = getNthChild(node,3);
-		drawTopologyLine(cr,
-			left+width/2, level*nodeheight*2+nodeheight/2,
-			left+2*(width/3)+width/6,
-			(level+1)*nodeheight*2+nodeheight/2,
-			node, child, col_lines);
-		drawTopologyTree(cr, child, myPhyID,
-			left+2*(width/3), width/3, level+1);
+	/* Lines first, the icons are drawn on top of their ends */
+	gdk_cairo_set_source_color(cr, col_lines);
+	for (i=0; i < layout->edgeCount; i++) {
+		edge = &layout->edges[i];
+		if (MAX(edge->x1, edge->x2) < visible->x
+			|| MIN(edge->x1, edge->x2)
+				> visible->x + visible->width
+			|| edge->y2 < visible->y
+			|| edge->y1 > visible->y + visible->height)
+			continue;
+		cairo_set_line_width(cr, edge->lineWidth);
+		cairo_move_to(cr, edge->x1, edge->y1);
+		cairo_line_to(cr, edge->x2, edge->y2);
+		cairo_stroke(cr);
 	}
 
-	/* Highlight Host controller and give it a Linux pixmap */
-	if (node->selfid[0].packetZero.phyID == myPhyID) {
-		if (strcmp(node->label, "Unknown") == 0)
-			strcpy(node->label, "Localhost");
-		xpm_node = xpm_cpu_linux;	/* Host controller */
-
-		gdk_cairo_set_source_color(cr, col_arc);
-		cairo_arc(cr, left + (width/2),
-			level*nodeheight*2 + nodeheight/2, nodewidth/2, 0, 2*M_PI);
-			
-		cairo_fill(cr);
+	count = treeLayoutVisible(layout, visible->x, visible->y,
+		visible->x + visible->width, visible->y + visible->height,
+		nodes);
+	for (i=0; i < count; i++) {
+		ln = &layout->nodes[nodes[i]];
+
+		if (zoom < LOD_DOTS) {
+			/* Too small for icons, just mark the node */
+			ln->textWidth = 0;
+			if (ln->highlight) gdk_cairo_set_source_color(cr, col_arc);
+			else cairo_set_source_rgb(cr, 0, 0, 0);
+			cairo_arc(cr, ln->x + NODEWIDTH/2,
+				ln->y + NODEHEIGHT/2, NODEWIDTH/4, 0, 2*M_PI);
+			cairo_fill(cr);
+			continue;
+		}
+
+		/* Highlight Host controller */
+		if (ln->highlight) {
+			gdk_cairo_set_source_color(cr, col_arc);
+			cairo_arc(cr, ln->x + NODEWIDTH/2,
+				ln->y + NODEHEIGHT/2, NODEWIDTH/2, 0, 2*M_PI);
+			cairo_fill(cr);
+		}
+
+		/* Icon and text are blitted from prescaled surfaces in
+		 * device space */
+		cairo_save(cr);
+		dx = ln->x + NODEWIDTH/2;
+		dy = ln->y + NODEHEIGHT/2;
+		cairo_user_to_device(cr, &dx, &dy);
+		tx = ln->textX;
+		ty = ln->speedY;
+		cairo_user_to_device(cr, &tx, &ty);
+		ly = ln->labelY - ln->speedY;
+		cairo_user_to_device_distance(cr, &lx, &ly);
+		cairo_identity_matrix(cr);
+
+		icon = iconSurface(cr, ln->icon, zoom, &xpmwidth, &xpmheight);
+		cairo_set_source_surface(cr, icon,
+				floor(dx - xpmwidth/2), floor(dy - xpmheight/2));
+		cairo_paint(cr);
+
+		textWidth = 0;
+		if (zoom >= LOD_TEXT) {
+			/* Draw speed string and label */
+			text = textSurface(cr, ln->speed, FONTHEIGHT*zoom,
+				&ascent, &width);
+			cairo_set_source_surface(cr, text, floor(tx),
+				floor(ty) - ascent);
+			cairo_paint(cr);
+			textWidth = width;
+			text = textSurface(cr, ln->label, FONTHEIGHT*zoom,
+				&ascent, &width);
+			cairo_set_source_surface(cr, text, floor(tx),
+				floor(ty + ly) - ascent);
+			cairo_paint(cr);
+			textWidth = MAX(textWidth, width);
+		}
+		/* In layout units, for repaintNode */
+		ln->textWidth = ceil((textWidth + 1) / zoom);
+		cairo_restore(cr);
+	}
+}
+
+/*
+ * Show the result of a verification after a bus reset.
+ * IN:		result:	1 verified, -1 failed, 0 nothing to show
+ * 		report:	description of the result
+ */
+static void showVerification(int result, char *report)
+{
+	switch (result) {
+		case 1:
+			showMessage(GTK_MESSAGE_INFO, report);
+			break;
+		case -1:
+			fprintf(stderr, "%s", report);
+			showMessage(GTK_MESSAGE_ERROR, report);
+			break;
+	}
+}
+
+/*
+ * Repaint a part of the main window from the current topology tree.
+ * IN:		drawing_area:	The drawing area of the main window
+ *		area:		The part to repaint, in window coordinates
+ */
+static void paintArea(GtkWidget *drawing_area, GdkRectangle *area)
+{
+	GdkRectangle visible;
+	GdkPixmap *pixmap = g_object_get_data(G_OBJECT(drawing_area), 
+			"back_pixmap");
+	cairo_t *cr;
+
+	if (pixmap == NULL) return;
+
+	cr = gdk_cairo_create(GDK_DRAWABLE(pixmap));
+	gdk_cairo_rectangle(cr, area);
+	cairo_clip(cr);
+	cairo_set_source_rgb(cr, 1, 1, 1);
+	cairo_paint(cr);
+
+	if (topologyTree != NULL) {
+		/* The part of the layout that is shown */
+		visible.x = floor((area->x - viewX) / viewZoom);
+		visible.y = floor((area->y - viewY) / viewZoom);
+		visible.width = ceil(area->width / viewZoom) + 1;
+		visible.height = ceil(area->height / viewZoom) + 1;
+		cairo_translate(cr, viewX, viewY);
+		cairo_scale(cr, viewZoom, viewZoom);
+		drawTreeLayout(cr, treeLayoutGet(topologyTree,
+			raw1394_get_local_id(handle) & 0x3f,
+			drawing_area->allocation.width,
+			drawing_area->allocation.height),
+			viewZoom, &visible);
 	}
 
-	/* Draw icon */
-	xpmwidth = gdk_pixbuf_get_width(xpm_node);
-	xpmheight = gdk_pixbuf_get_height(xpm_node);
-	gdk_cairo_set_source_pixbuf(cr, xpm_node, 
-			left + (width/2 - xpmwidth/2),
-			level*nodeheight*2 + (nodeheight-xpmheight)/2);
-	cairo_rectangle(cr, 
-			left + (width/2 - xpmwidth/2),
-			level*nodeheight*2 + (nodeheight-xpmheight)/2,
-			xpmwidth, xpmheight);
-	cairo_fill(cr);
-
-	cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_OBLIQUE,
-			CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, FONTHEIGHT);
-	cairo_set_source_rgb(cr, 0, 0, 0);
-	/* Draw speed string */
-	cairo_move_to(cr, left + (width/2 - nodewidth/2), 
-			level*nodeheight*2+nodeheight+FONTHEIGHT);
-	cairo_show_text(cr, decode_speed(node->selfid[0].packetZero.phySpeed));
-
-	/* Draw label */
-	cairo_move_to(cr, left + (width/2 - nodewidth/2), 
-			level*nodeheight*2+nodeheight+FONTHEIGHT*2);
-	cairo_show_text(cr, node->label);
+	cairo_destroy(cr);
+	gtk_widget_draw(drawing_area, area);
 }
 
 /*
- * Repaint the main window.
+ * Repaint the main window from the current topology tree. Never touches the
+ * bus, new trees are delivered by the scan worker.
  * IN:		data:	A pointer to the drawable of the main window
  * RESULT:	TRUE on success, FALSE otherwise
  */
 gint Repaint (gpointer data) 
 {
-	RAW1394topologyMap* topologyMap;
-	int nodeCount, depth;
 	GtkWidget* drawing_area = (GtkWidget *) data;
-	GdkRectangle update_rect;
-	int width, height;
-	GdkDrawable *drawable;
-	GdkGC *gc;
-	GdkPixmap *pixmap = g_object_get_data(G_OBJECT(drawing_area), 
-			"back_pixmap");
-	cairo_t *cr = gdk_cairo_create(GDK_DRAWABLE(pixmap));
-
-	nodeCount = raw1394_get_nodecount(handle);
-	topologyMap = raw1394GetTopologyMap(handle);
-	/*topologyMap = generateTestTopologyMap(7);*/
-	if (topologyMap == NULL) {
-		fprintf(stderr, "Could not read topologyMap\n");
-		return (TRUE);
+	GdkRectangle area;
+
+	if (topologyTree != NULL) {
+		DEBUG_GENERAL fprintf(stderr, "Root id: %d\n",
+			topologyTree->selfid[topologyTreeRoot(topologyTree)][0]
+			.packetZero.phyID);
+		DEBUG_GENERAL fprintf(stderr, "\nTree depth: %d\n",
+			topologyTreeDepth(topologyTree));
 	}
-	if (topologyTree != NULL) freeTopologyTree(topologyTree);
-	topologyTree = spawnTopologyTree(handle, topologyMap);
 
-	DEBUG_GENERAL fprintf(stderr, "Root id: %d\n",
-		topologyTreeRoot(topologyTree)->selfid[0].packetZero.phyID);
+	area.x = 0;
+	area.y = 0;
+	area.width = drawing_area->allocation.width;
+	area.height = drawing_area->allocation.height;
+	paintArea(drawing_area, &area);
 
-	depth = topologyTreeDepth(topologyTree);
-	DEBUG_GENERAL fprintf(stderr, "\nTree depth: %d\n", depth);
+	return (TRUE);
+}
 
-	drawable = drawing_area->window;
-	gc = gdk_gc_new(drawing_area->window);
+/*
+ * Repaint a rectangle of the drawing, given in layout units.
+ */
+static void repaintLayoutArea(int x0, int y0, int x1, int y1)
+{
+	GdkRectangle area;
+
+	/* Into the window, and limited to it */
+	x0 = MAX(0, floor(x0 * viewZoom + viewX));
+	y0 = MAX(0, floor(y0 * viewZoom + viewY));
+	x1 = MIN(drawing_area->allocation.width, ceil(x1 * viewZoom + viewX) + 1);
+	y1 = MIN(drawing_area->allocation.height, ceil(y1 * viewZoom + viewY) + 1);
+	if (x1 <= x0 || y1 <= y0) return;
+	area.x = x0;
+	area.y = y0;
+	area.width = x1 - x0;
+	area.height = y1 - y0;
+	paintArea(drawing_area, &area);
+}
 
-	width = drawing_area->allocation.width;
-	height = drawing_area->allocation.height;
+/*
+ * Repaint only the part of the main window that shows a node: its icon,
+ * its text and the lines to its parent and childs.
+ * IN:		node:	phyID of the node
+ */
+static void repaintNode(int node)
+{
+	TreeLayout *layout;
+	LayoutNode *ln;
+	LayoutEdge *edge;
+	int i, x0, y0, x1, y1, textY, oldRight;
+
+	layout = treeLayoutGet(topologyTree, raw1394_get_local_id(handle)
+		& 0x3f, drawing_area->allocation.width,
+		drawing_area->allocation.height);
+	ln = &layout->nodes[layout->nodeIndex[node]];
+	textY = ln->y + NODEHEIGHT + FONTHEIGHT*2 + FONTHEIGHT/2;
+	/* The text as it was drawn last, so a shorter one leaves nothing */
+	oldRight = MAX(ln->x + NODEWIDTH, ln->textX + ln->textWidth);
+	x0 = ln->x;
+	y0 = ln->y;
+	x1 = oldRight;
+	y1 = textY;
+	for (i=0; i < layout->edgeCount; i++) {
+		edge = &layout->edges[i];
+		if (edge->node != node && edge->child != node) continue;
+		x0 = MIN(x0, MIN(edge->x1, edge->x2) - edge->lineWidth);
+		x1 = MAX(x1, MAX(edge->x1, edge->x2) + edge->lineWidth);
+		y0 = MIN(y0, edge->y1);
+		y1 = MAX(y1, edge->y2);
+	}
+	repaintLayoutArea(x0, y0, x1, y1);
 
-	gdk_draw_rectangle(pixmap,
-		drawing_area->style->white_gc,
-		TRUE,
-		0, 0, width, height);
+	/* A longer text is only measured while it is drawn */
+	if (ln->textX + ln->textWidth > oldRight)
+		repaintLayoutArea(oldRight, ln->y, ln->textX + ln->textWidth,
+			textY);
+}
 
-	if (depth != 0)
-		drawTopologyTree(cr, topologyTree,
-			raw1394_get_local_id(handle) & 0x3f, 0, width, 0);
+/*
+ * Check the result of PHY configuration packets after their reset, once
+ * all ROMs of the tree are known.
+ */
+static void verifyTree(void)
+{
+	char report[256];
 
-	cairo_destroy(cr);
-	gdk_gc_unref(gc);
+	showVerification(gapCountVerify(topologyTree, report, sizeof(report)),
+		report);
+	showVerification(rootAdvisorVerify(topologyTree, report,
+		sizeof(report)), report);
+}
 
-	update_rect.x = 0;
-	update_rect.y = 0;
-	update_rect.width = width;
-	update_rect.height = height;
-	gtk_widget_draw(drawing_area, &update_rect);
+static void avc_arm_timer(void);
 
-	return (TRUE);
+/*
+ * Find a node of the current tree by its GUID, see avc_resubscribe.
+ */
+static int lookupGuid(quadlet_t guid_hi, quadlet_t guid_lo, void *data)
+{
+	int i;
+
+	for (i=0; i < topologyTree->nodeCount; i++)
+		if (!topologyTree->romPending[i]
+			&& topologyTree->rom_info[i].guid_hi == guid_hi
+			&& topologyTree->rom_info[i].guid_lo == guid_lo)
+			return i;
+	return -1;
 }
 
 /*
- * Detect which node was clicked.
- * IN:		node:	The topologyTree or SubTree
- * 		left:	left offset of drawing area
- * 		width:	width of drawing area
- * 		level:	depth of the current subTree in respect to the root
- * 		x:	x position of mouse click
- * 		y:	y position of mouse click
- * RESULT:	clicked node or NULL if no node was clicked
+ * Called when all ROMs of the current tree are known.
  */
-TopologyTree *detectClick(TopologyTree *node, int left, int width, int level,
-			int x, int y) 
+static void treeComplete(void)
 {
-    	TopologyTree *child;
-	TopologyTree *click;
-
-	if (y > level*NODEHEIGHT*2 && y < (level*NODEHEIGHT*2)+NODEHEIGHT) {
-		if (x > (left+width/2)-NODEWIDTH/2
-			&& x < (left+width/2)+NODEWIDTH/2) {
-				/* Click detected, return phyID */
-				return node;
+	verifyTree();
+	/* The AV/C subscriptions wait for the new phyIDs after a reset */
+	avc_resubscribe(lookupGuid, NULL);
+	avc_arm_timer();
+}
+
+/*
+ * Show a tree published by the scan worker. A rescan of the same topology
+ * only repaints the nodes that changed.
+ */
+static void installTree(TopologyTree *tree)
+{
+	unsigned char changed[MAX_NODES];
+	int i, count;
+
+	if (snapshot != NULL) {
+		/* A snapshot is shown, the bus is rescanned when it is
+		 * closed */
+		freeTopologyTree(tree);
+		return;
+	}
+	count = -1;
+	if (topologyTree != NULL)
+		count = treeLayoutRebind(tree,
+			raw1394_get_local_id(handle) & 0x3f, changed);
+	if (topologyTree != NULL)
+		freeTopologyTree(topologyTree);
+	topologyTree = tree;
+	if (topologyTree->romsPending == 0) treeComplete();
+	if (count < 0) Repaint((gpointer) drawing_area);
+	for (i=0; i < count; i++) repaintNode(changed[i]);
+}
+
+/*
+ * Called in the GTK main loop when the scan worker has published a new
+ * tree or ROM. A new tree is shown right away, even if its ROMs are still
+ * being read; every ROM that arrives later only repaints its node.
+ * RESULT:	always FALSE (run once)
+ */
+gboolean scan_published(gpointer data)
+{
+	TopologyTree *tree;
+	RomUpdate *update;
+
+	if ((tree = scanWorkerTake()) != NULL) installTree(tree);
+
+	while ((update = scanWorkerTakeRom()) != NULL) {
+		/*
+		 * The worker publishes a tree before the ROMs of its scan,
+		 * so a ROM of a newer scan means that tree was published
+		 * after the take above.
+		 */
+		if (snapshot == NULL && (topologyTree == NULL
+			|| update->scan > topologyTree->scan)
+			&& (tree = scanWorkerTake()) != NULL)
+			installTree(tree);
+		if (snapshot == NULL && topologyTree != NULL
+			&& update->scan == topologyTree->scan
+			&& topologyTree->romPending[update->node]) {
+			free_rom_info(&topologyTree->rom_info[update->node]);
+			topologyTree->rom_info[update->node] =
+				update->rom_info;
+			topologyTree->romPending[update->node] = 0;
+			treeLayoutUpdateNode(topologyTree, update->node);
+			repaintNode(update->node);
+			if (--topologyTree->romsPending == 0) treeComplete();
 		} else {
-			/* No need to go beyond this level, truncate search */
-			return NULL;
+			/* Left over from a superseded scan */
+			free_rom_info(&update->rom_info);
 		}
+		free(update);
 	}
-	if (numberOfChilds(node) == 0) {
-		/* We are a leaf */
-		return NULL;
-	} else if (numberOfChilds(node) == 1) {
-		/* Process one child directly beneath us */
-		child = getNthChild(node,1);
-		return detectClick(child, left, width, level+1, x, y);
-	} else if (numberOfChilds(node) == 2) {
-		/* Process two childs left and right beneath us */
-		child = getNthChild(node,1);
-		click = detectClick(child, left, width/2, level+1, x, y);
-		if (click != NULL) return click;
-		child = getNthChild(node,2);
-		return detectClick(child, left+width/2, width/2, level+1, x, y);
-	} else if (numberOfChilds(node) == 3) {
-		/* Process three childs left, right and directly beneath us */
-		child = getNthChild(node,1);
-		click = detectClick(child, left, width/3, level+1, x, y);
-		if (click != NULL) return click;
-		child = getNthChild(node,2);
-		click = detectClick(child, left, width, level+1, x, y);
-		if (click != NULL) return click;
-		child = getNthChild(node,3);
-		return detectClick(child, left+2*(width/3), width/3, level+1,
-			x, y);
-	}
-	return NULL;
+	return FALSE;
 }
 
+
 /*
  * Called whenever the window is made visible. Copys the pixmap to the window.
  * IN:		widget:	the drawing area
@@ -389,7 +486,8 @@ static gint expose_event(GtkWidget *widget, GdkEventExpose *event)
 }
 
 /*
- * Called when the window is created or resized.
+ * Called when the window is created, moved or resized. Only redraws the
+ * last published tree, the bus is not touched.
  * IN:		widget:	the drawing area
  * 		event:	the configure event
  * RESULT:	always TRUE
@@ -398,8 +496,14 @@ static gint configure_event(GtkWidget *widget, GdkEventConfigure *event)
 {
 	GdkDrawable *pixmap = g_object_get_data(G_OBJECT(widget), 
 					"back_pixmap");
+	gint width, height;
 
 	if (pixmap) {
+		/* Moving the window does not change the picture */
+		gdk_drawable_get_size(pixmap, &width, &height);
+		if (width == widget->allocation.width
+			&& height == widget->allocation.height)
+			return TRUE;
 		gdk_drawable_unref(pixmap);
 	}
 
@@ -424,17 +528,13 @@ static gint configure_event(GtkWidget *widget, GdkEventConfigure *event)
 #define CTLUNIT AVC_CTYPE_CONTROL | AVC_SUBUNIT_TYPE_UNIT | AVC_SUBUNIT_ID_IGNORE
 #define STATUNIT AVC_CTYPE_STATUS | AVC_SUBUNIT_TYPE_UNIT | AVC_SUBUNIT_ID_IGNORE
 /*
- * Find out if an AVC device is currently playing
- * IN:		handle: the libraw1394 handle
- * 		phyID:	the phyisical ID of the node
+ * Find out if a transport state response says the device is playing
+ * IN:		response:	the response to a transport state query
  * RETURNS:	OPERAND if device is playing
  * 		0 otherwise
  */
-int isPlaying(raw1394handle_t handle, int phyID)
+int isPlaying(quadlet_t response)
 {
-	quadlet_t response = avc_transaction(handle, phyID, STATVCR0
-		| VCR_COMMAND_TRANSPORT_STATE | VCR_OPERAND_TRANSPORT_STATE,
-		AVC_RETRY);
 	if (AVC_MASK_OPCODE(response)
 		== VCR_RESPONSE_TRANSPORT_STATE_PLAY)
 		return AVC_GET_OPERAND0(response);
@@ -443,17 +543,13 @@ int isPlaying(raw1394handle_t handle, int phyID)
 }
 
 /*
- * Find out if an AVC device is currently recording
- * IN:		handle: the libraw1394 handle
- * 		phyID:	the phyisical ID of the node
+ * Find out if a transport state response says the device is recording
+ * IN:		response:	the response to a transport state query
  * RETURNS:	OPERAND if device is recording
  * 		0 otherwise
  */
-int isRecording(raw1394handle_t handle, int phyID)
+int isRecording(quadlet_t response)
 {
-	quadlet_t response = avc_transaction(handle, phyID, STATVCR0
-		| VCR_COMMAND_TRANSPORT_STATE | VCR_OPERAND_TRANSPORT_STATE,
-                AVC_RETRY);
 	if (AVC_MASK_OPCODE(response)
 		== VCR_RESPONSE_TRANSPORT_STATE_RECORD)
 		return AVC_GET_OPERAND0(response);
@@ -461,40 +557,145 @@ int isRecording(raw1394handle_t handle, int phyID)
 		return 0;
 }
 
+static guint avcTimer = 0;
+
+/*
+ * Fail the AV/C commands that have run past their deadline and sleep until
+ * the next one.
+ */
+static gboolean avc_timer(gpointer data)
+{
+	int next;
+
+	avcTimer = 0;
+	next = avc_check_timeouts();
+	if (next >= 0) avcTimer = g_timeout_add(next + 1, avc_timer, NULL);
+	return FALSE;
+}
+
+/*
+ * (Re)start the AV/C timer after a command was submitted, its deadline may
+ * be earlier than the one the timer waits for.
+ */
+static void avc_arm_timer(void)
+{
+	if (avcTimer) g_source_remove(avcTimer);
+	avc_timer(NULL);
+}
+
+/*
+ * Send a command to the tape recorder of a node without waiting for the
+ * response.
+ */
+static void vcr_command(int phyID, quadlet_t command)
+{
+	quadlet_t request = CTLVCR0 | command;
+
+	avc_submit(handle, phyID, &request, 1, 0, NULL, NULL);
+	avc_arm_timer();
+}
+
+/* Buttons whose command depends on the transport state */
+enum { VCR_PLAY, VCR_REWIND, VCR_PAUSE, VCR_FORWARD };
+
+/*
+ * Called with the transport state of a node after one of the buttons that
+ * depend on it was clicked. Sends the command for that button.
+ * IN:		node:		the phyisical ID of the node
+ *		response:	the transport state
+ *		data:		the button
+ */
+static void vcr_button_state(nodeid_t node, quadlet_t *response, int len,
+	void *data)
+{
+	quadlet_t state;
+	int mode;
+
+	if (response == NULL) return;
+	state = response[0];
+	switch (GPOINTER_TO_INT(data)) {
+	case VCR_PLAY:
+		if (isPlaying(state) == VCR_OPERAND_PLAY_FORWARD)
+			vcr_command(node, VCR_COMMAND_PLAY
+				| VCR_OPERAND_PLAY_SLOWEST_FORWARD);
+		else
+			vcr_command(node, VCR_COMMAND_PLAY
+				| VCR_OPERAND_PLAY_FORWARD);
+		break;
+	case VCR_REWIND:
+		if (isPlaying(state))
+			vcr_command(node, VCR_COMMAND_PLAY
+				| VCR_OPERAND_PLAY_FASTEST_REVERSE);
+		else
+			vcr_command(node, VCR_COMMAND_WIND
+				| VCR_OPERAND_WIND_REWIND);
+		break;
+	case VCR_PAUSE:
+		if ((mode = isRecording(state))) {
+			if (mode == VCR_OPERAND_RECORD_PAUSE)
+				vcr_command(node, VCR_COMMAND_RECORD
+					| VCR_OPERAND_RECORD_RECORD);
+			else
+				vcr_command(node, VCR_COMMAND_RECORD
+					| VCR_OPERAND_RECORD_PAUSE);
+		} else if (isPlaying(state)
+			== VCR_OPERAND_PLAY_FORWARD_PAUSE) {
+			vcr_command(node, VCR_COMMAND_PLAY
+				| VCR_OPERAND_PLAY_FORWARD);
+		} else {
+			vcr_command(node, VCR_COMMAND_PLAY
+				| VCR_OPERAND_PLAY_FORWARD_PAUSE);
+		}
+		break;
+	case VCR_FORWARD:
+		if (isPlaying(state))
+			vcr_command(node, VCR_COMMAND_PLAY
+				| VCR_OPERAND_PLAY_FASTEST_FORWARD);
+		else
+			vcr_command(node, VCR_COMMAND_WIND
+				| VCR_OPERAND_WIND_FAST_FORWARD);
+		break;
+	}
+}
+
+/*
+ * Ask a node for its transport state; the command for the button is sent
+ * by vcr_button_state when the answer arrives, so the GUI and other nodes
+ * are not held up by a slow device.
+ * IN:		phyID:	the phyisical ID of the node
+ *		button:	VCR_PLAY, VCR_REWIND, VCR_PAUSE or VCR_FORWARD
+ */
+static void vcr_button(int phyID, int button)
+{
+	quadlet_t request = STATVCR0 | VCR_COMMAND_TRANSPORT_STATE
+		| VCR_OPERAND_TRANSPORT_STATE;
+
+	avc_submit(handle, phyID, &request, 1, 0, vcr_button_state,
+		GINT_TO_POINTER(button));
+	avc_arm_timer();
+}
+
 /*
  * Called when the play button is clicked. Send a play command to a node
  * normally, or a play slow motion command if the node is already playing at
  * normal speed.
  * IN:		widget:	the button
- * 		data:	The node
+ * 		data:	The phyID of the node
  */
 void avc_play(GtkWidget *widget, gpointer data)
 {
-	int phyID;
-
-	phyID = ((TopologyTree *)data)->selfid[0].packetZero.phyID;
-	if (isPlaying(handle, phyID) == VCR_OPERAND_PLAY_FORWARD) {
-		send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_PLAY | VCR_OPERAND_PLAY_SLOWEST_FORWARD);
-	} else {
-		send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_PLAY | VCR_OPERAND_PLAY_FORWARD);
-	}
+	vcr_button(GPOINTER_TO_INT(data), VCR_PLAY);
 }
 
 /*
  * Called when the stop button is clicked. Send a stop command to a node.
  * IN:		widget:	the button
- * 		data:	The node
+ * 		data:	The phyID of the node
  */
 void avc_stop(GtkWidget *widget, gpointer data)
 {
-	int phyID;
-
-	phyID = ((TopologyTree *)data)->selfid[0].packetZero.phyID;
-	send_avc_command(handle, phyID, CTLVCR0
-		| VCR_COMMAND_WIND | VCR_OPERAND_WIND_STOP);
-
+	vcr_command(GPOINTER_TO_INT(data),
+		VCR_COMMAND_WIND | VCR_OPERAND_WIND_STOP);
 }
 
 /*
@@ -502,53 +703,21 @@ void avc_stop(GtkWidget *widget, gpointer data)
  * node is stopped or a play_rewind command when the node is playing or
  * paused to a node.
  * IN:		widget:	the button
- * 		data:	The node
+ * 		data:	The phyID of the node
  */
 void avc_rewind(GtkWidget *widget, gpointer data) 
 {
-	int phyID;
-
-	phyID = ((TopologyTree *)data)->selfid[0].packetZero.phyID;
-	if (isPlaying(handle, phyID)) {
-		send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_PLAY | VCR_OPERAND_PLAY_FASTEST_REVERSE);
-
-	} else {
-		send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_WIND | VCR_OPERAND_WIND_REWIND);
-
-	}
+	vcr_button(GPOINTER_TO_INT(data), VCR_REWIND);
 }
 
 /*
  * Called when the pause button is clicked. Send a pause command to a node.
  * IN:		widget:	the button
- * 		data:	The node
+ * 		data:	The phyID of the node
  */
 void avc_pause(GtkWidget *widget, gpointer data) 
 {
-	int phyID, mode;
-
-	phyID = ((TopologyTree *)data)->selfid[0].packetZero.phyID;
-	if ((mode = isRecording(handle, phyID))) {
-		if (mode == VCR_OPERAND_RECORD_PAUSE) {
-			send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_RECORD | VCR_OPERAND_RECORD_RECORD);
-		} else {
-			send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_RECORD | VCR_OPERAND_RECORD_PAUSE);
-		}
-	} else {
-		if (isPlaying(handle, phyID)
-			==VCR_OPERAND_PLAY_FORWARD_PAUSE) {
-			send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_PLAY | VCR_OPERAND_PLAY_FORWARD);
-		} else {
-			send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_PLAY | VCR_OPERAND_PLAY_FORWARD_PAUSE);
-		}
-	}
-
+	vcr_button(GPOINTER_TO_INT(data), VCR_PAUSE);
 }
 
 /*
@@ -556,103 +725,83 @@ void avc_pause(GtkWidget *widget, gpointer data)
  * node is stopped or a play_forward command when the node is playing or
  * paused to a node.
  * IN:		widget:	the button
- * 		data:	The node
+ * 		data:	The phyID of the node
  */
 void avc_forward(GtkWidget *widget, gpointer data) 
 {
-	int phyID;
-
-	phyID = ((TopologyTree *)data)->selfid[0].packetZero.phyID;
-	if (isPlaying(handle, phyID)) {
-		send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_PLAY | VCR_OPERAND_PLAY_FASTEST_FORWARD);
-	} else {
-		send_avc_command(handle, phyID, CTLVCR0
-			| VCR_COMMAND_WIND | VCR_OPERAND_WIND_FAST_FORWARD);
-
-	}
+	vcr_button(GPOINTER_TO_INT(data), VCR_FORWARD);
 }
 
 /*
  * Called when the eject button is clicked. Send an eject command to a node.
  * IN:		widget:	the button
- * 		data:	The node
+ * 		data:	The phyID of the node
  */
 void avc_eject(GtkWidget *widget, gpointer data) 
 {
-	int phyID;
-
-	phyID = ((TopologyTree *)data)->selfid[0].packetZero.phyID;
-	send_avc_command(handle, phyID, CTLVCR0
-		| VCR_COMMAND_LOAD_MEDIUM | VCR_OPERAND_LOAD_MEDIUM_EJECT);
+	vcr_command(GPOINTER_TO_INT(data),
+		VCR_COMMAND_LOAD_MEDIUM | VCR_OPERAND_LOAD_MEDIUM_EJECT);
 }
 
 /*
  * Called when the record button is clicked. Send a record command to a node.
  * IN:		widget:	the button
- * 		data:	The node
+ * 		data:	The phyID of the node
  */
 void avc_record(GtkWidget *widget, gpointer data) 
 {
-	int phyID;
-
-	phyID = ((TopologyTree *)data)->selfid[0].packetZero.phyID;
-	send_avc_command(handle, phyID, CTLVCR0
-		| VCR_COMMAND_RECORD | VCR_OPERAND_RECORD_RECORD);
+	vcr_command(GPOINTER_TO_INT(data),
+		VCR_COMMAND_RECORD | VCR_OPERAND_RECORD_RECORD);
 }
 
-#define MAX_DESCRIPTORS 0x100
-void avc_test_descriptors(int phyID, quadlet_t subunit_type,
-			quadlet_t subunit_id) 
+/*
+ * Print the descriptors and opcodes a node implements, see avc_probe.
+ */
+static void avc_probe_report(nodeid_t node, avc_capabilities_t *caps,
+	void *data)
 {
 	int i;
-	quadlet_t response;
-	char descriptors[MAX_DESCRIPTORS];
-
-	fprintf(stderr, "*** Test descriptors ***\n");
-
-	memset(descriptors,0,MAX_DESCRIPTORS);
-	for (i=0; i<MAX_DESCRIPTORS; i++) {
-		response = avc_transaction(handle, phyID,
-			AVC_CTYPE_SPECIFIC_INQUIRY
-			| subunit_type | subunit_id
-			| AVC_COMMAND_OPEN_DESCRIPTOR | i, AVC_RETRY);
-		if (AVC_MASK_RESPONSE(response) == AVC_RESPONSE_IMPLEMENTED) {
-			descriptors[i] = -1;
-		}
-	}
-	fprintf(stderr, "Unit Descriptors:");
-	for (i=0; i<MAX_DESCRIPTORS; i++)
-		if (descriptors[i])fprintf(stderr, " 0x02%X", i);
+
+	if (caps == NULL) return;
+	fprintf(stderr, "Node %d unit descriptors:", node);
+	for (i=0; i<256; i++)
+		if (AVC_CAPABLE(caps->descriptors, i))
+			fprintf(stderr, " 0x%02X", i);
+	fprintf(stderr, "\nNode %d unit opcodes:", node);
+	for (i=0; i<256; i++)
+		if (AVC_CAPABLE(caps->opcodes, i))
+			fprintf(stderr, " 0x%02X", i);
 	fprintf(stderr, "\n");
 }
 
 struct status_entry {
-	TopologyTree *node;
+	int phyID;
 	GtkWidget *entry;
+	int subscription;	/* transport state, see avc_subscribe */
 };
 
-gint update_avc_status(gpointer data) 
+/*
+ * Called with every new transport state of the node.
+ */
+static void avc_status_received(nodeid_t node, quadlet_t *response, int len,
+	void *data)
 {
 	struct status_entry *status_entry = (struct status_entry *) data;
-	char *status;
-	int phyID;
 
-	if (data == NULL) return FALSE;
-
-	DEBUG_AVC fprintf(stderr, "Getting AV/C status\n");
-	if (!GTK_IS_WIDGET(status_entry->entry)) return FALSE;
-	phyID = status_entry->node->selfid[0].packetZero.phyID;
+	DEBUG_AVC fprintf(stderr, "AV/C status of node %d changed\n", node);
+	gtk_entry_set_text(GTK_ENTRY(status_entry->entry), response == NULL
+		? "No response" : avc_decode_vcr_response(response[0]));
+}
 
-	status = avc_decode_vcr_response(avc_transaction(handle, phyID,
-			STATVCR0 | VCR_COMMAND_TRANSPORT_STATE
-			| VCR_OPERAND_TRANSPORT_STATE, AVC_RETRY));
+static void avc_status_entry_destroyed(GtkWidget *widget, gpointer data)
+{
+	struct status_entry *status_entry = (struct status_entry *) data;
 
-	gtk_entry_set_text(GTK_ENTRY(status_entry->entry), status);
-	return TRUE;
+	avc_unsubscribe(status_entry->subscription);
+	free(status_entry);
 }
 
-GtkWidget *make_avc_buttons(TopologyTree *node) 
+GtkWidget *make_avc_buttons(int phyID, Rom_info *rom_info) 
 {
 	GtkWidget *hbox1, *hbox2, *hbox3, *vbox, *button, *label, *entry;
 	struct status_entry *status_entry;
@@ -665,37 +814,37 @@ GtkWidget *make_avc_buttons(TopologyTree *node)
 	hbox3 = gtk_hbox_new(FALSE, 0);
 	button = gtk_button_new_with_label("<<");
 	g_signal_connect(GTK_OBJECT(button), "clicked",
-		G_CALLBACK(avc_rewind), node);
+		G_CALLBACK(avc_rewind), GINT_TO_POINTER(phyID));
 	gtk_widget_show(button);
 	gtk_box_pack_start(GTK_BOX(hbox1), button, TRUE, TRUE, 0);
 	button = gtk_button_new_with_label("PLAY");
 	g_signal_connect(GTK_OBJECT(button), "clicked",
-		G_CALLBACK(avc_play), node);
+		G_CALLBACK(avc_play), GINT_TO_POINTER(phyID));
 	gtk_widget_show(button);
 	gtk_box_pack_start(GTK_BOX(hbox1), button, TRUE, TRUE, 0);
 	button = gtk_button_new_with_label(">>");
 	g_signal_connect(GTK_OBJECT(button), "clicked",
-		G_CALLBACK(avc_forward), node);
+		G_CALLBACK(avc_forward), GINT_TO_POINTER(phyID));
 	gtk_widget_show(button);
 	gtk_box_pack_start(GTK_BOX(hbox1), button, TRUE, TRUE, 0);
 	button = gtk_button_new_with_label("STOP");
 	g_signal_connect(GTK_OBJECT(button), "clicked",
-		G_CALLBACK(avc_stop), node);
+		G_CALLBACK(avc_stop), GINT_TO_POINTER(phyID));
 	gtk_widget_show(button);
 	gtk_box_pack_start(GTK_BOX(hbox2), button, TRUE, TRUE, 0);
 	button = gtk_button_new_with_label("||");
 	g_signal_connect(GTK_OBJECT(button), "clicked",
-		G_CALLBACK(avc_pause), node);
+		G_CALLBACK(avc_pause), GINT_TO_POINTER(phyID));
 	gtk_widget_show(button);
 	gtk_box_pack_start(GTK_BOX(hbox2), button, TRUE, TRUE, 0);
 	button = gtk_button_new_with_label("Eject");
 	g_signal_connect(GTK_OBJECT(button), "clicked",
-		G_CALLBACK(avc_eject), node);
+		G_CALLBACK(avc_eject), GINT_TO_POINTER(phyID));
 	gtk_widget_show(button);
 	gtk_box_pack_start(GTK_BOX(hbox2), button, TRUE, TRUE, 0);
 	button = gtk_button_new_with_label("Record");
 	g_signal_connect(GTK_OBJECT(button), "clicked",
-		G_CALLBACK(avc_record), node);
+		G_CALLBACK(avc_record), GINT_TO_POINTER(phyID));
 	gtk_widget_show(button);
 	gtk_box_pack_start(GTK_BOX(hbox2), button, TRUE, TRUE, 0);
 
@@ -716,10 +865,15 @@ GtkWidget *make_avc_buttons(TopologyTree *node)
 	gtk_box_pack_start(GTK_BOX(vbox), hbox3, FALSE, FALSE, 0);
 	gtk_widget_show(vbox);
 
-	status_entry->node = node;
+	status_entry->phyID = phyID;
 	status_entry->entry = entry;
-
-	g_timeout_add(500, update_avc_status, status_entry);
+	g_signal_connect(GTK_OBJECT(entry), "destroy",
+		G_CALLBACK(avc_status_entry_destroyed), status_entry);
+	status_entry->subscription = avc_subscribe(handle, phyID,
+		rom_info->guid_hi, rom_info->guid_lo, STATVCR0 | VCR_COMMAND_TRANSPORT_STATE
+		| VCR_OPERAND_TRANSPORT_STATE, avc_status_received,
+		status_entry);
+	avc_arm_timer();
 
 	return vbox;
 }
@@ -779,79 +933,117 @@ void append_subunit_strings(char *buf, quadlet_t table[8]) {
 	*buf++ = 0;
 }
 
+/*
+ * The AV/C subunit section of a node info dialog, filled in when the
+ * subunit info has arrived.
+ */
+typedef struct SubunitInfo_t {
+	avc_subunit_query_t	query;
+	GtkTextBuffer		*buffer;
+	GtkTextMark		*mark;		/* start of the section */
+} SubunitInfo;
+
+/*
+ * Replace the placeholder of the AV/C subunit section, see avc_subunit_info.
+ */
+static void subunitInfoDone(nodeid_t node, quadlet_t *table, void *data)
+{
+	SubunitInfo *info = (SubunitInfo *) data;
+	GtkTextIter start, end;
+	char avcstring[MAXAVCSTRINGCHARS];
+
+	DEBUG_GENERAL fprintf(stderr,"Got AVC subunit info\n");
+	if (table == NULL) strcpy(avcstring, "Error getting subunit info\n");
+	else append_subunit_strings(avcstring, table);
+	gtk_text_buffer_get_iter_at_mark(info->buffer, &start, info->mark);
+	gtk_text_buffer_get_end_iter(info->buffer, &end);
+	gtk_text_buffer_delete(info->buffer, &start, &end);
+	gtk_text_buffer_insert(info->buffer, &start, avcstring, -1);
+}
+
+/*
+ * Stop the subunit info query when its dialog is closed.
+ */
+static void subunitInfoDestroy(GtkWidget *widget, gpointer data)
+{
+	SubunitInfo *info = (SubunitInfo *) data;
+
+	avc_subunit_info_cancel(&info->query);
+	g_free(info);
+}
+
 /*
  * Popup a dialog displaying various detailed information about a particular
  * node.
- * IN:		node: The node to display information about
+ * IN:		tree: The topologyTree
+ * 		node: The node to display information about
  */
-void popup_nodeinfo(TopologyTree *node) {
+void popup_nodeinfo(TopologyTree *tree, int node) {
 	GtkWidget *button, *dialog_window, *hbox, *text, *sw;
 	char *s;
 	char textualleafes[MAXTEXTLEAFCHARS];
 	int nchars, nleafes, i;
-	quadlet_t table[8];
-	char avcstring[MAXAVCSTRINGCHARS];
+	SubunitInfo *info = NULL;
+	GtkTextIter end;
+	char *avcstring;
 
 	dialog_window = gtk_dialog_new();
 	g_signal_connect(GTK_OBJECT(dialog_window), "destroy",
 		G_CALLBACK(ClosingDialog),
 		&dialog_window);
-	if (node->label != NULL && node->label[0] != '\0') {
+	if (getNodeLabel(tree, node)[0] != '\0') {
 		gtk_window_set_title(GTK_WINDOW(dialog_window),
-		node->label);
+		getNodeLabel(tree, node));
 	} else
 		gtk_window_set_title(GTK_WINDOW(dialog_window), "Node Info");
 	gtk_container_set_border_width(GTK_CONTAINER(dialog_window), 5);
 	/*gtk_window_set_default_size(GTK_WINDOW(dialog_window), 300, 250);*/
 	gtk_window_set_default_size(GTK_WINDOW(dialog_window), 300, 300);
 
-	nleafes = node->rom_info.nr_textual_leafes;
+	nleafes = tree->rom_info[node].nr_textual_leafes;
 	nchars = (nleafes != 0) ? MAXTEXTLEAFCHARS / nleafes : 0;
 	textualleafes[0] = '\0';
 	if (nchars != 0) {
 		for(i=0; i<nleafes; i++) {
-			if (node->rom_info.textual_leafes[i] != NULL) {
+			if (tree->rom_info[node].textual_leafes[i] != NULL) {
 				strncat(textualleafes, "\n", 1);
-				strncat(textualleafes, node->rom_info
+				strncat(textualleafes, tree->rom_info[node]
 					.textual_leafes[i], nchars);
 			}
 		}
 	}
 
-	DEBUG_GENERAL fprintf(stderr,"Getting AVC subunit info\n");
-	if (get_node_type(&node->rom_info) == NODE_TYPE_AVC) {
-		if (avc_subunit_info(handle, node->selfid[0].packetZero.phyID,table) < 0) {
-			strcpy(avcstring, "Error getting subunit info\n");
-		} else {
-			append_subunit_strings(avcstring, table);
-		}
-	} else {
-		strcpy(avcstring, "N/A\n");
+	/* The subunit info is filled in when the device has answered */
+	avcstring = "N/A\n";
+	if (get_node_type(&tree->rom_info[node]) == NODE_TYPE_AVC) {
+		DEBUG_GENERAL fprintf(stderr,"Getting AVC subunit info\n");
+		info = g_malloc0(sizeof(SubunitInfo));
+		info->query.request = -1;
+		avcstring = "";
 	}
-	DEBUG_GENERAL fprintf(stderr,"Got AVC subunit info\n");
 
 	//sprintf(s, "SelfID Info\n-----------\nPhysical ID: %i\nLink active: %s\nGap Count: %i\nPHY Speed: %s\nPHY Delay: %s\nIRM Capable: %s\nPower Class: %s\nPort 0: %s\nPort 1: %s\nPort 2: %s\nInit. reset: %s\n\nCSR ROM Info\n------------\nGUID: 0x%08X%08X\nNode Capabilities: 0x%08X\nVendor ID: 0x%08X\nUnit Spec ID: 0x%08X\nUnit SW Version: 0x%08X\nModel ID: 0x%08X\nNr. Textual Leafes: %i\n\nTextual Leafes: %s\n\nAV/C Subunits\n-------------\n%s",
 	s = g_strdup_printf("SelfID Info\n-----------\nPhysical ID: %i\nLink active: %s\nGap Count: %i\nPHY Speed: %s\nPHY Delay: %s\nIRM Capable: %s\nPower Class: %s\n%sInit. reset: %s\n\nCSR ROM Info\n------------\nGUID: 0x%08X%08X\nNode Capabilities: 0x%08X\nVendor ID: 0x%08X\nUnit Spec ID: 0x%08X\nUnit SW Version: 0x%08X\nModel ID: 0x%08X\nNr. Textual Leafes: %i\n\nVendor: %s\nTextual Leafes: %s\n\nAV/C Subunits\n-------------\n%s",
-		node->selfid[0].packetZero.phyID,
-		yes_no(node->selfid[0].packetZero.linkActive),
-		node->selfid[0].packetZero.gapCount,
-		decode_speed(node->selfid[0].packetZero.phySpeed),
-		decode_delay(node->selfid[0].packetZero.phyDelay),
-		yes_no(node->selfid[0].packetZero.contender),
-		decode_pwr(node->selfid[0].packetZero.powerClass),
-		//decode_port_status(node->selfid[0].packetZero.port0),
-		//decode_port_status(node->selfid[0].packetZero.port1),
-		//decode_port_status(node->selfid[0].packetZero.port2),
-		decode_all_ports_status(node->selfid),
-		yes_no(node->selfid[0].packetZero.initiatedReset),
-		node->rom_info.guid_hi, node->rom_info.guid_lo,
-		node->rom_info.node_capabilities,
-		node->rom_info.vendor_id,
-		node->rom_info.unit_spec_id,
-		node->rom_info.unit_sw_version,
-		node->rom_info.model_id,
-		node->rom_info.nr_textual_leafes,
-		node->rom_info.vendor,
+		tree->selfid[node][0].packetZero.phyID,
+		yes_no(tree->selfid[node][0].packetZero.linkActive),
+		tree->selfid[node][0].packetZero.gapCount,
+		decode_speed(tree->selfid[node][0].packetZero.phySpeed),
+		decode_delay(tree->selfid[node][0].packetZero.phyDelay),
+		yes_no(tree->selfid[node][0].packetZero.contender),
+		decode_pwr(tree->selfid[node][0].packetZero.powerClass),
+		//decode_port_status(tree->selfid[node][0].packetZero.port0),
+		//decode_port_status(tree->selfid[node][0].packetZero.port1),
+		//decode_port_status(tree->selfid[node][0].packetZero.port2),
+		decode_all_ports_status(tree->selfid[node]),
+		yes_no(tree->selfid[node][0].packetZero.initiatedReset),
+		tree->rom_info[node].guid_hi, tree->rom_info[node].guid_lo,
+		tree->rom_info[node].node_capabilities,
+		tree->rom_info[node].vendor_id,
+		tree->rom_info[node].unit_spec_id,
+		tree->rom_info[node].unit_sw_version,
+		tree->rom_info[node].model_id,
+		tree->rom_info[node].nr_textual_leafes,
+		tree->rom_info[node].vendor,
 		textualleafes,
 		avcstring);
 
@@ -860,15 +1052,40 @@ void popup_nodeinfo(TopologyTree *node) {
 	gtk_text_buffer_insert_at_cursor(gtk_text_view_get_buffer(GTK_TEXT_VIEW(text)), s, -1);
 	g_free(s);
 
+	if (info != NULL) {
+		info->buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text));
+		gtk_text_buffer_get_end_iter(info->buffer, &end);
+		info->mark = gtk_text_buffer_create_mark(info->buffer, NULL,
+			&end, TRUE);
+		g_signal_connect(GTK_OBJECT(text), "destroy",
+			G_CALLBACK(subunitInfoDestroy), info);
+		if (avc_subunit_info(handle,
+			tree->selfid[node][0].packetZero.phyID, &info->query,
+			subunitInfoDone, info) < 0) {
+			subunitInfoDone(0, NULL, info);
+		} else {
+			gtk_text_buffer_insert(info->buffer, &end,
+				"Reading subunit info...\n", -1);
+			avc_arm_timer();
+		}
+	}
+
 	sw = gtk_scrolled_window_new(NULL, NULL);
 	gtk_container_add(GTK_CONTAINER(sw), text);
 
 	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog_window)->vbox),
 		sw, TRUE, TRUE, 0);
 
-	if (get_node_type(&node->rom_info) == NODE_TYPE_AVC) {
+	if (get_node_type(&tree->rom_info[node]) == NODE_TYPE_AVC) {
 		gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog_window)->vbox),
-			make_avc_buttons(node), FALSE, TRUE, 0);
+			make_avc_buttons(tree->selfid[node][0].packetZero.phyID,
+			&tree->rom_info[node]), FALSE, TRUE, 0);
+		DEBUG_AVC {
+			avc_probe(handle, tree->selfid[node][0].packetZero.phyID,
+				&tree->rom_info[node], AVC_SUBUNIT_TYPE_UNIT
+				| AVC_SUBUNIT_ID_IGNORE, avc_probe_report, NULL);
+			avc_arm_timer();
+		}
 	}
 
 	button = gtk_button_new_with_label("OK");
@@ -884,60 +1101,221 @@ void popup_nodeinfo(TopologyTree *node) {
 	gtk_widget_show_all(dialog_window);
 }
 
+/*
+ * Get the layout of the shown tree for the current window size.
+ * RESULT:	the layout, NULL if no tree is shown
+ */
+static TreeLayout *currentLayout(void) {
+	if (topologyTree == NULL) return NULL;
+	return treeLayoutGet(topologyTree, raw1394_get_local_id(handle) & 0x3f,
+		drawing_area->allocation.width,
+		drawing_area->allocation.height);
+}
+
+/*
+ * Find the node at a position in the window, taking zoom and pan into
+ * account.
+ * RESULT:	phyID of the node or -1
+ */
+static int nodeAt(TreeLayout *layout, double x, double y) {
+	return treeLayoutHit(layout, (int) floor((x - viewX) / viewZoom),
+		(int) floor((y - viewY) / viewZoom));
+}
+
+/*
+ * Zoom the view, keeping the layout point under a window position fixed.
+ * IN:		factor:	relative change of the zoom
+ * 		x, y:	the fixed window position
+ */
+void zoomView(double factor, double x, double y) {
+	double zoom = viewZoom * factor;
+
+	if (zoom < ZOOM_MIN) zoom = ZOOM_MIN;
+	if (zoom > ZOOM_MAX) zoom = ZOOM_MAX;
+	viewX = x - (x - viewX) * zoom / viewZoom;
+	viewY = y - (y - viewY) * zoom / viewZoom;
+	viewZoom = zoom;
+	Repaint((gpointer) drawing_area);
+}
+
+/*
+ * Reset the view to normal size or zoom it so the whole tree fits into
+ * the window.
+ * IN:		fit:	0 for normal size, 1 to fit the tree into the window
+ */
+void fitView(int fit) {
+	TreeLayout *layout = currentLayout();
+	int width = drawing_area->allocation.width;
+	int height = drawing_area->allocation.height;
+
+	viewZoom = 1.0;
+	viewX = viewY = 0;
+	if (fit && layout != NULL) {
+		viewZoom = MIN((double) width / layout->extentWidth,
+			(double) height / layout->extentHeight);
+		if (viewZoom > 1.0) viewZoom = 1.0;
+		if (viewZoom < ZOOM_MIN) viewZoom = ZOOM_MIN;
+		/* The layout is already centered if it fits at normal size */
+		if (layout->extentWidth > width)
+			viewX = (width - layout->extentWidth * viewZoom) / 2;
+		viewY = (height - layout->extentHeight * viewZoom) / 2;
+		if (viewY > 0) viewY = 0;
+	}
+	Repaint((gpointer) drawing_area);
+}
+
 /*
  * Called when the mouse button is pressed in the main window. Check if a node
- * was clicked, and pop up an information dialog if so.
+ * was clicked, and pop up an information dialog if so. Otherwise the view
+ * is dragged until the button is released.
  * IN:		widget:	not used
  * 		event:	the button press event
  * RESULT:	TRUE
  */
 static gint button_press_event(GtkWidget *widget, GdkEventButton *event) {
-	int x, y, width, height;
-	GdkModifierType state;
-	TopologyTree *node;
+	int node = -1;
 
 	if (event->type == GDK_BUTTON_PRESS) {
-		x = event->x;
-		y = event->y;
-		state = event->state;
-		gdk_drawable_get_size(GDK_DRAWABLE(event->window), &width, &height);
-		node = detectClick(topologyTree, 0, width, 0, x, y);
-		if (node != NULL) {
-			popup_nodeinfo(node);
+		if (event->button == 1 && topologyTree != NULL)
+			node = nodeAt(currentLayout(), event->x, event->y);
+		if (node >= 0) {
+			popup_nodeinfo(topologyTree, node);
+		} else {
+			panning = 1;
+			panX = event->x;
+			panY = event->y;
 		}
 	}
 	return TRUE;
 }
 
+static gint button_release_event(GtkWidget *widget, GdkEventButton *event) {
+	panning = 0;
+	return TRUE;
+}
+
 /*
- * Called whenever a bus reset has occured before the last read was startet.
- * Calls Repaint().
+ * Called when the pointer is moved with a button pressed. Drags the view.
+ * IN:		widget:	not used
+ * 		event:	the motion event
+ * RESULT:	TRUE
+ */
+static gint motion_notify_event(GtkWidget *widget, GdkEventMotion *event) {
+	if (!panning) return TRUE;
+	viewX += event->x - panX;
+	viewY += event->y - panY;
+	panX = event->x;
+	panY = event->y;
+	Repaint((gpointer) drawing_area);
+	return TRUE;
+}
+
+/*
+ * Called when the scroll wheel is turned in the main window. Zooms around
+ * the pointer.
+ * IN:		widget:	not used
+ * 		event:	the scroll event
+ * RESULT:	TRUE
+ */
+static gint scroll_event(GtkWidget *widget, GdkEventScroll *event) {
+	if (event->direction == GDK_SCROLL_UP)
+		zoomView(ZOOM_STEP, event->x, event->y);
+	else if (event->direction == GDK_SCROLL_DOWN)
+		zoomView(1/ZOOM_STEP, event->x, event->y);
+	return TRUE;
+}
+
+/*
+ * Called when the pointer rests over the main window. Shows the label,
+ * phyID, speed and GUID of the node under the pointer.
+ * IN:		widget:	the drawing area
+ * 		x, y:	pointer position
+ * 		tooltip: the tooltip to fill in
+ * RESULT:	TRUE if there is a node under the pointer
+ */
+static gboolean query_tooltip(GtkWidget *widget, gint x, gint y,
+	gboolean keyboard_mode, GtkTooltip *tooltip, gpointer data) {
+	TreeLayout *layout;
+	LayoutNode *ln;
+	GdkRectangle area;
+	char text[256];
+	int node;
+
+	if (topologyTree == NULL || keyboard_mode || panning) return FALSE;
+	layout = currentLayout();
+	if ((node = nodeAt(layout, x, y)) < 0) return FALSE;
+
+	ln = &layout->nodes[layout->nodeIndex[node]];
+	snprintf(text, sizeof(text), "%s\nNode %d, %s\nGUID %08x%08x",
+		getNodeLabel(topologyTree, node), node,
+		ln->speed, topologyTree->rom_info[node].guid_hi,
+		topologyTree->rom_info[node].guid_lo);
+	gtk_tooltip_set_text(tooltip, text);
+	/* Ask again when the pointer leaves the node */
+	area.x = floor(ln->x * viewZoom + viewX);
+	area.y = floor(ln->y * viewZoom + viewY);
+	area.width = ceil(NODEWIDTH * viewZoom);
+	area.height = ceil(NODEHEIGHT * viewZoom);
+	gtk_tooltip_set_tip_area(tooltip, &area);
+	return TRUE;
+}
+
+/*
+ * Called when the bus generation has been stable for the settle window.
+ * Rescans the bus once, or waits again if the generation has moved on.
+ */
+gint settle_timer(gpointer data) {
+	settleTimer = 0;
+	if (raw1394_get_generation(handle) != settleGeneration) {
+		settleGeneration = raw1394_get_generation(handle);
+		settleTimer = g_timeout_add(settleWindow, settle_timer, NULL);
+		return FALSE;
+	}
+	DEBUG_GENERAL fprintf(stderr, "Generation %d settled, rescanning\n",
+		settleGeneration);
+	scanWorkerRequest();
+	return FALSE;
+}
+
+/*
+ * Called whenever a bus reset has occured.
+ * (Re)starts the settle timer, so a burst of resets during hot-plugging
+ * results in a single rescan.
  */
 int bus_reset_handler(raw1394handle_t handle, unsigned int generation) {
 	DEBUG_GENERAL fprintf(stderr,
 		"Bus reset - current generation number: %d\n", generation);
 	raw1394_update_generation(handle, generation);
-	//Repaint((gpointer) drawing_area);
-	repaintCountdown = 10;	/* Repaint 10 times until reset is finished */
+	avc_bus_reset();
+	settleGeneration = generation;
+	if (settleTimer) g_source_remove(settleTimer);
+	settleTimer = g_timeout_add(settleWindow, settle_timer, NULL);
 	return 0;
 }
 
 /*
- * Called periodically by the timer.
- * Performs a dummy read to the cycle time register on the local node to
- * trigger the bus_reset_handler callback whenever a bus reset has occured.
+ * Called by the GLib main loop when the raw1394 file descriptor becomes
+ * readable. Dispatches the pending events (bus resets, FCP requests and
+ * responses) to their handlers.
  */
-gint dummy_read(gpointer data) {
-	quadlet_t quadlet;
+gboolean raw1394_event(GIOChannel *source, GIOCondition condition,
+	gpointer data) {
+	struct pollfd pfd;
 
-	/* Repaint if repaintCountdown is running */
-	if (repaintCountdown) {
-		repaintCountdown--;
-		Repaint((gpointer) drawing_area);
+	if (condition & (G_IO_ERR | G_IO_HUP)) {
+		fprintf(stderr, "raw1394 connection lost\n");
+		return FALSE;
 	}
-	cooked1394_read(handle, 0xffc0 | raw1394_get_local_id(handle),
-		CSR_REGISTER_BASE + CSR_CYCLE_TIME, 4,
-		(quadlet_t *) &quadlet);
+	/*
+	 * A read started from a dialog may have consumed the event already,
+	 * and raw1394_loop_iterate blocks when there is none, so check first.
+	 */
+	pfd.fd = raw1394_get_fd(handle);
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+		raw1394_loop_iterate(handle);
+	/* The handlers may have sent new AV/C commands */
+	avc_arm_timer();
 	return TRUE;
 }
 
@@ -959,9 +1337,22 @@ GtkWidget *makeDrawingArea(int x, int y) {
 		G_CALLBACK (configure_event), NULL);
 	g_signal_connect (GTK_OBJECT (drawing_area), "button_press_event",
 		G_CALLBACK (button_press_event), NULL);
+	g_signal_connect (GTK_OBJECT (drawing_area), "button_release_event",
+		G_CALLBACK (button_release_event), NULL);
+	g_signal_connect (GTK_OBJECT (drawing_area), "motion_notify_event",
+		G_CALLBACK (motion_notify_event), NULL);
+	g_signal_connect (GTK_OBJECT (drawing_area), "scroll_event",
+		G_CALLBACK (scroll_event), NULL);
+	g_signal_connect (GTK_OBJECT (drawing_area), "query-tooltip",
+		G_CALLBACK (query_tooltip), NULL);
+	g_object_set(G_OBJECT(drawing_area), "has-tooltip", TRUE, NULL);
 	gtk_widget_set_events(drawing_area, GDK_EXPOSURE_MASK
 		| GDK_LEAVE_NOTIFY_MASK
-		| GDK_BUTTON_PRESS_MASK);
+		| GDK_BUTTON_PRESS_MASK
+		| GDK_BUTTON_RELEASE_MASK
+		| GDK_BUTTON1_MOTION_MASK
+		| GDK_BUTTON2_MOTION_MASK
+		| GDK_SCROLL_MASK);
 	return drawing_area;
 }
 
@@ -974,11 +1365,14 @@ int main (int argc, char *argv[])
 	GtkWidget *window;
 	GtkWidget *vbox;
 	GtkWidget *menu_bar;
+	GIOChannel *channel;
 	quadlet_t quadlet;
 	int c, level;
 	int port = 0;
+	long value;
+	char *end;
 	/* Parse command line options */
-	const char *optstring = "p:v::";
+	const char *optstring = "p:s:v::";
 
 	do {
 		c = getopt(argc, argv, optstring);
@@ -992,6 +1386,18 @@ int main (int argc, char *argv[])
  		        case 'p':
 			        if (optarg == NULL) port = 0;
 				else port = atoi(optarg);
+				break;
+			case 's':
+				value = strtol(optarg, &end, 10);
+				if (*end != '\0' || end == optarg || value <= 0
+					|| value > INT_MAX) {
+					fprintf(stderr, "Invalid settle window: "
+						"%s\n", optarg);
+					fprintf(stderr, usage);
+					exit(1);
+				}
+				settleWindow = value;
+				break;
 	 
 		}
 	} while (c != -1);
@@ -1029,6 +1435,7 @@ int main (int argc, char *argv[])
 
 	raw1394_set_bus_reset_handler(handle, bus_reset_handler);
 
+	g_thread_init(NULL);
 	gtk_init (&argc, &argv);
 	window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
 	vbox = gtk_vbox_new (FALSE, 0);
@@ -1043,8 +1450,17 @@ int main (int argc, char *argv[])
 	gtk_box_pack_start (GTK_BOX (vbox), drawing_area, TRUE, TRUE, 0);
 
 	gtk_widget_show_all (window);
-	Repaint((gpointer) drawing_area);
-	g_timeout_add(100, dummy_read, NULL);
+	if (scanWorkerStart(port, scan_published) < 0) {
+		perror("couldn't start the scan worker");
+		exit(1);
+	}
+	scanWorkerRequest();
+
+	/* Handle bus resets and FCP traffic as soon as they arrive */
+	channel = g_io_channel_unix_new(raw1394_get_fd(handle));
+	g_io_add_watch(channel, G_IO_IN | G_IO_ERR | G_IO_HUP, raw1394_event,
+		NULL);
+	g_io_channel_unref(channel);
 
 	gtk_main ();	/* Should never return */
 
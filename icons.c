@@ -18,6 +18,9 @@
  */
 
 #include "icons.h"
+#include "fatal.h"
+#include <string.h>
+#include <math.h>
 
 #include "gnome-question.xpm"
 #include "gnome-qeye.xpm"
@@ -39,8 +42,34 @@ GdkPixbuf *xpm_cpu_windows = NULL;
 static int chooseIconVendor(Rom_info *, GdkPixbuf **, char **);
 static int contains(char *, char *);
 
+#define ICON_SCALE_STEP 8	/* scales are rounded to 1/8 */
+#define ICON_CACHE_SIZE 32	/* 7 icons at a few zoom levels */
+
+typedef struct IconSurface_t {
+	GdkPixbuf	*icon;
+	int		scale;		/* in 1/ICON_SCALE_STEP */
+	int		width, height;
+	cairo_surface_t	*surface;
+} IconSurface;
+
+static IconSurface iconCache[ICON_CACHE_SIZE];
+static int iconCacheNext = 0;	/* slot to replace when full */
+
+#define TEXT_CACHE_SIZE 256	/* direct mapped by hash */
+
+typedef struct TextSurface_t {
+	char		*text;
+	int		size;		/* in 1/ICON_SCALE_STEP pixels */
+	int		ascent;
+	int		width;
+	cairo_surface_t	*surface;
+} TextSurface;
+
+static TextSurface textCache[TEXT_CACHE_SIZE];
+
 void initIcons(void) 
 {
+	if (xpm_unknown != NULL) return;	/* already loaded */
 	xpm_unknown = gdk_pixbuf_new_from_xpm_data(gnome_question_xpm);
 	xpm_dvcr = gdk_pixbuf_new_from_xpm_data(gnome_qeye_xpm);
 	xpm_disk = gdk_pixbuf_new_from_xpm_data(gtcd_xpm);
@@ -107,3 +136,129 @@ int contains(char *s1, char *s2) {
 
 }
 
+
+cairo_surface_t *iconSurface(cairo_t *cr, GdkPixbuf *icon, double scale,
+	int *width, int *height)
+{
+	IconSurface *entry;
+	cairo_t *icr;
+	int i, step;
+
+	step = (int) (scale*ICON_SCALE_STEP + 0.5);
+	if (step < 1) step = 1;
+	for (i=0; i < ICON_CACHE_SIZE; i++) {
+		entry = &iconCache[i];
+		if (entry->icon == icon && entry->scale == step) {
+			*width = entry->width;
+			*height = entry->height;
+			return entry->surface;
+		}
+	}
+
+	/* Not cached yet, replace the oldest entry */
+	entry = &iconCache[iconCacheNext];
+	iconCacheNext = (iconCacheNext + 1) % ICON_CACHE_SIZE;
+	if (entry->surface != NULL) cairo_surface_destroy(entry->surface);
+	entry->icon = icon;
+	entry->scale = step;
+	entry->width = (gdk_pixbuf_get_width(icon)*step + ICON_SCALE_STEP-1)
+		/ ICON_SCALE_STEP;
+	entry->height = (gdk_pixbuf_get_height(icon)*step + ICON_SCALE_STEP-1)
+		/ ICON_SCALE_STEP;
+	entry->surface = cairo_surface_create_similar(cairo_get_target(cr),
+		CAIRO_CONTENT_COLOR_ALPHA, entry->width, entry->height);
+
+	icr = cairo_create(entry->surface);
+	cairo_scale(icr, (double) step/ICON_SCALE_STEP,
+		(double) step/ICON_SCALE_STEP);
+	gdk_cairo_set_source_pixbuf(icr, icon, 0, 0);
+	cairo_paint(icr);
+	cairo_destroy(icr);
+
+	DEBUG_GENERAL fprintf(stderr, "Icon surface %dx%d cached\n",
+		entry->width, entry->height);
+	*width = entry->width;
+	*height = entry->height;
+	return entry->surface;
+}
+
+/*
+ * Measure a line of text in the font the node texts are drawn with.
+ */
+static void textExtents(cairo_t *cr, const char *text, double size,
+	cairo_font_extents_t *font, cairo_text_extents_t *extents)
+{
+	cairo_save(cr);
+	cairo_identity_matrix(cr);
+	cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_OBLIQUE,
+			CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, size);
+	cairo_font_extents(cr, font);
+	cairo_text_extents(cr, text, extents);
+	cairo_restore(cr);
+}
+
+cairo_surface_t *textSurface(cairo_t *cr, const char *text, double size,
+	int *ascent, int *width)
+{
+	TextSurface *entry;
+	cairo_text_extents_t extents;
+	cairo_font_extents_t font;
+	cairo_t *tcr;
+	unsigned int hash = 2166136261U;	/* FNV-1a */
+	const char *p;
+	int step;
+
+	step = (int) (size*ICON_SCALE_STEP + 0.5);
+	if (step < 1) step = 1;
+	for (p=text; *p; p++) hash = (hash ^ (unsigned char) *p) * 16777619U;
+	hash = (hash ^ step) * 16777619U;
+	entry = &textCache[hash % TEXT_CACHE_SIZE];
+	if (entry->text != NULL && entry->size == step
+		&& strcmp(entry->text, text) == 0) {
+		*ascent = entry->ascent;
+		*width = entry->width;
+		return entry->surface;
+	}
+
+	/* Not cached, replace whatever is in the slot */
+	if (entry->surface != NULL) cairo_surface_destroy(entry->surface);
+	free(entry->text);
+	if ((entry->text = strdup(text)) == NULL) fatal("out of memory!");
+	entry->size = step;
+
+	textExtents(cr, text, (double) step/ICON_SCALE_STEP, &font, &extents);
+	entry->ascent = ceil(font.ascent);
+	entry->width = MAX(1, (int) ceil(extents.x_advance) + 2);
+	entry->surface = cairo_surface_create_similar(cairo_get_target(cr),
+		CAIRO_CONTENT_COLOR_ALPHA, entry->width,
+		MAX(1, entry->ascent + (int) ceil(font.descent)));
+	tcr = cairo_create(entry->surface);
+	cairo_select_font_face(tcr, "sans-serif", CAIRO_FONT_SLANT_OBLIQUE,
+			CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(tcr, (double) step/ICON_SCALE_STEP);
+	cairo_set_source_rgb(tcr, 0, 0, 0);
+	cairo_move_to(tcr, 0, entry->ascent);
+	cairo_show_text(tcr, text);
+	cairo_destroy(tcr);
+
+	*ascent = entry->ascent;
+	*width = entry->width;
+	return entry->surface;
+}
+
+int measureText(const char *text, double size)
+{
+	static cairo_t *cr = NULL;
+	cairo_surface_t *surface;
+	cairo_font_extents_t font;
+	cairo_text_extents_t extents;
+
+	if (cr == NULL) {
+		surface = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+		cr = cairo_create(surface);
+		cairo_surface_destroy(surface);
+	}
+	textExtents(cr, text, size, &font, &extents);
+	return MAX(1, (int) ceil(extents.x_advance) + 2);
+}
@@ -26,3 +26,39 @@ void initIcons(void);
 
 void chooseIcon(Rom_info *rom_info, GdkPixbuf **xpm_node, char **label);
 
+/*
+ * Get an icon rendered into a cairo surface similar to the target of cr,
+ * so drawing it is a plain blit. One surface is made per icon and scale
+ * (rounded to ICON_SCALE_STEP) and kept in a cache; the caller must not
+ * destroy it.
+ * IN:		cr:	the context the icon will be drawn with
+ *		icon:	one of the icons chosen by chooseIcon
+ *		scale:	zoom factor times the device scale
+ *		width, height: set to the size of the surface
+ * RETURNS:	the surface, owned by the cache
+ */
+cairo_surface_t *iconSurface(cairo_t *cr, GdkPixbuf *icon, double scale,
+	int *width, int *height);
+
+/*
+ * Get a line of text (speed or label of a node) rendered in black into a
+ * cairo surface similar to the target of cr, from a cache keyed by text
+ * and scale. The caller must not destroy the surface.
+ * IN:		cr:	the context the text will be drawn with
+ *		text:	the text
+ *		size:	font size in device pixels
+ *		ascent:	set to the distance of the baseline from the top
+ *		width:	set to the width of the surface
+ * RETURNS:	the surface, owned by the cache
+ */
+cairo_surface_t *textSurface(cairo_t *cr, const char *text, double size,
+	int *ascent, int *width);
+
+/*
+ * Measure a line of text as textSurface would draw it, without a target.
+ * IN:		text:	the text
+ *		size:	font size in pixels
+ * RETURNS:	the width of the surface textSurface would return
+ */
+int measureText(const char *text, double size);
+
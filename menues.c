@@ -25,8 +25,20 @@
 #include <ctype.h>		// isprint()
 #include <string.h>		// strlen()
 #include "menues.h"
+#include "speedMap.h"
+#include "gapCount.h"
+#include "rootAdvisor.h"
+#include "snapshot.h"
+#include "treeLayout.h"
+#include "scanWorker.h"
 
 extern raw1394handle_t handle;	// From gscanbus.c
+extern TopologyTree *topologyTree;	// From gscanbus.c
+extern Snapshot *snapshot;		// From gscanbus.c
+extern GtkWidget *drawing_area;		// From gscanbus.c
+gint Repaint(gpointer data);		// From gscanbus.c
+void zoomView(double factor, double x, double y);	// From gscanbus.c
+void fitView(int fit);			// From gscanbus.c
 
 /*
  * Closes a dialog window.
@@ -45,6 +57,21 @@ void ClosingDialog(GtkWidget *widget, gpointer data) {
 	gtk_grab_remove(GTK_WIDGET(widget));
 }
 
+/*
+ * Show a message in a non-modal dialog.
+ * IN:		type:		GTK_MESSAGE_INFO, GTK_MESSAGE_ERROR, etc.
+ * 		message:	the text to show
+ */
+void showMessage(GtkMessageType type, const char *message) {
+	GtkWidget *dialog;
+
+	dialog = gtk_message_dialog_new(NULL, 0, type, GTK_BUTTONS_CLOSE,
+		"%s", message);
+	g_signal_connect_swapped(GTK_OBJECT(dialog), "response",
+		G_CALLBACK(gtk_widget_destroy), dialog);
+	gtk_widget_show(dialog);
+}
+
 typedef struct {
 	GtkWidget *entries[3];
 	GtkWidget *text;
@@ -432,6 +459,342 @@ static void forceBusResetApp(gpointer callback_data, guint callback_action,
 
 }
 
+/*
+ * Callback for the rescan menu item from the menu bar. Forgets all cached
+ * scans, so the configuration ROMs are read again after the reset.
+ */
+static void rescanApp(gpointer callback_data, guint callback_action,
+	GtkWidget *widget) {
+
+	scanWorkerFlushCache();
+	raw1394_reset_bus(handle);
+}
+
+/*
+ * Callback for the show speed map menu item from the menu bar.
+ */
+static void showSpeedMapApp(gpointer callback_data, guint callback_action,
+	GtkWidget *widget) {
+	GtkWidget *dialog_window, *text, *sw;
+	PangoFontDescription *font;
+	SpeedMap *speedMap;
+	char *s = NULL;
+	size_t len = 0;
+	FILE *stream;
+
+	speedMap = getSpeedMap(topologyTree);
+	if (speedMap == NULL) return;
+	stream = open_memstream(&s, &len);
+	if (stream == NULL) fatal("out of memory!");
+	writeSpeedMap(stream, speedMap);
+	fclose(stream);
+
+	dialog_window = makeDialogWindow("Speed Map");
+	gtk_window_set_default_size(GTK_WINDOW(dialog_window), 640, 400);
+
+	text = gtk_text_view_new();
+	gtk_text_view_set_editable(GTK_TEXT_VIEW(text), FALSE);
+	font = pango_font_description_from_string("monospace");
+	gtk_widget_modify_font(text, font);
+	pango_font_description_free(font);
+	gtk_text_buffer_set_text(gtk_text_view_get_buffer(GTK_TEXT_VIEW(text)),
+		s, len);
+	free(s);
+
+	sw = gtk_scrolled_window_new(NULL, NULL);
+	gtk_container_add(GTK_CONTAINER(sw), text);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog_window)->vbox),
+		sw, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog_window)->action_area),
+		makeButton("Close", G_CALLBACK(CloseDialog), dialog_window),
+		TRUE, TRUE, 0);
+
+	gtk_widget_show_all(dialog_window);
+}
+
+/*
+ * Callback for the export speed map menu item from the menu bar.
+ */
+static void exportSpeedMapApp(gpointer callback_data, guint callback_action,
+	GtkWidget *widget) {
+	GtkWidget *chooser;
+	SpeedMap *speedMap;
+	char *filename;
+	FILE *file;
+
+	speedMap = getSpeedMap(topologyTree);
+	if (speedMap == NULL) return;
+
+	chooser = gtk_file_chooser_dialog_new("Export Speed Map", NULL,
+		GTK_FILE_CHOOSER_ACTION_SAVE,
+		GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+		GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT, NULL);
+	gtk_file_chooser_set_do_overwrite_confirmation(
+		GTK_FILE_CHOOSER(chooser), TRUE);
+	gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(chooser),
+		"speedmap.txt");
+	if (gtk_dialog_run(GTK_DIALOG(chooser)) == GTK_RESPONSE_ACCEPT) {
+		filename = gtk_file_chooser_get_filename(
+			GTK_FILE_CHOOSER(chooser));
+		if ((file = fopen(filename, "w")) == NULL) {
+			perror(filename);
+		} else {
+			writeSpeedMap(file, speedMap);
+			fclose(file);
+		}
+		g_free(filename);
+	}
+	gtk_widget_destroy(chooser);
+}
+
+/*
+ * A snapshot of a tree whose ROMs are still being read would hold the
+ * "Reading ROM..." placeholders instead of the ROM images.
+ * RETURNS:	1 if ROMs are pending (and a message was shown), 0 otherwise
+ */
+static int refuseOnRomsPending(void) {
+	if (topologyTree->romsPending == 0) return 0;
+	showMessage(GTK_MESSAGE_WARNING, "The configuration ROMs are still "
+		"being read. Save the snapshot when the scan is complete.");
+	return 1;
+}
+
+/*
+ * Callback for the save snapshot menu item from the menu bar.
+ */
+static void saveSnapshotApp(gpointer callback_data, guint callback_action,
+	GtkWidget *widget) {
+	GtkWidget *chooser;
+	char *filename;
+
+	if (topologyTree == NULL) return;
+	if (refuseOnRomsPending()) return;
+
+	chooser = gtk_file_chooser_dialog_new("Save Snapshot", NULL,
+		GTK_FILE_CHOOSER_ACTION_SAVE,
+		GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+		GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT, NULL);
+	gtk_file_chooser_set_do_overwrite_confirmation(
+		GTK_FILE_CHOOSER(chooser), TRUE);
+	gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(chooser),
+		"bus.gsbs");
+	if (gtk_dialog_run(GTK_DIALOG(chooser)) == GTK_RESPONSE_ACCEPT) {
+		filename = gtk_file_chooser_get_filename(
+			GTK_FILE_CHOOSER(chooser));
+		/* The bus may have been rescanned while the dialog ran */
+		if (topologyTree != NULL && !refuseOnRomsPending()
+			&& writeSnapshot(filename, topologyTree) < 0)
+			perror(filename);
+		g_free(filename);
+	}
+	gtk_widget_destroy(chooser);
+}
+
+/*
+ * Callback for the open snapshot menu item from the menu bar. The snapshot
+ * is shown instead of the bus until it is closed.
+ */
+static void openSnapshotApp(gpointer callback_data, guint callback_action,
+	GtkWidget *widget) {
+	GtkWidget *chooser;
+	Snapshot *opened, *previous;
+	TopologyTree *tree;
+	char *filename;
+
+	chooser = gtk_file_chooser_dialog_new("Open Snapshot", NULL,
+		GTK_FILE_CHOOSER_ACTION_OPEN,
+		GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+		GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT, NULL);
+	if (gtk_dialog_run(GTK_DIALOG(chooser)) == GTK_RESPONSE_ACCEPT) {
+		filename = gtk_file_chooser_get_filename(
+			GTK_FILE_CHOOSER(chooser));
+		if ((opened = openSnapshot(filename)) != NULL
+			&& (tree = spawnSnapshotTopologyTree(opened)) != NULL) {
+			/* The old tree may point into the old snapshot */
+			treeLayoutInvalidate();
+			if (topologyTree != NULL) freeTopologyTree(topologyTree);
+			topologyTree = tree;
+			previous = snapshot;
+			snapshot = opened;
+			Repaint((gpointer) drawing_area);
+			if (previous != NULL) closeSnapshot(previous);
+		} else {
+			if (opened != NULL) closeSnapshot(opened);
+			showMessage(GTK_MESSAGE_ERROR,
+				"Could not open the snapshot.");
+		}
+		g_free(filename);
+	}
+	gtk_widget_destroy(chooser);
+}
+
+/*
+ * Callback for the close snapshot menu item from the menu bar. Returns to
+ * showing the bus.
+ */
+static void closeSnapshotApp(gpointer callback_data, guint callback_action,
+	GtkWidget *widget) {
+	Snapshot *previous;
+
+	if (snapshot == NULL) return;
+	previous = snapshot;
+	snapshot = NULL;
+	/* The tree points into the snapshot */
+	treeLayoutInvalidate();
+	if (topologyTree != NULL) freeTopologyTree(topologyTree);
+	topologyTree = NULL;
+	closeSnapshot(previous);
+	Repaint((gpointer) drawing_area);
+	scanWorkerRequest();
+}
+
+/*
+ * The gap count and root node tools send PHY configuration packets to the
+ * bus, which must not be computed from the tree of a snapshot.
+ * RETURNS:	1 if a snapshot is shown (and a message was shown), 0 otherwise
+ */
+static int refuseOnSnapshot(void) {
+	if (snapshot == NULL) return 0;
+	showMessage(GTK_MESSAGE_WARNING, "A snapshot is shown. Close the "
+		"snapshot to configure the bus.");
+	return 1;
+}
+
+/*
+ * Applies the optimal gap count from the gap count dialog
+ * IN:		widget:	not used
+ * 		data:	the dialog
+ */
+void gapCountAppOk(GtkWidget *widget, gpointer data) {
+	char report[512];
+	TransactionDialog *dialog;
+
+	dialog = (TransactionDialog *) data;
+	if (topologyTree == NULL || refuseOnSnapshot()) return;
+
+	gapCountApply(handle, topologyTree, gtk_toggle_button_get_active(
+		GTK_TOGGLE_BUTTON(dialog->entries[0])), report, sizeof(report));
+	gtk_text_buffer_set_text(gtk_text_view_get_buffer(
+		GTK_TEXT_VIEW(dialog->text)), report, -1);
+}
+
+/*
+ * Callback for the optimize gap count menu item from the menu bar.
+ */
+static void gapCountApp(gpointer callback_data, guint callback_action,
+	GtkWidget *widget) {
+	char report[512];
+	TransactionDialog *dialog;
+
+	if (topologyTree == NULL || refuseOnSnapshot()) return;
+	gapCountReport(topologyTree, report, sizeof(report));
+
+	dialog = makeTransactionDialog("Optimize Gap Count");
+	gtk_window_set_default_size(GTK_WINDOW(dialog->dialog), 400, 250);
+
+	dialog->text = gtk_text_view_new();
+	gtk_text_view_set_editable(GTK_TEXT_VIEW(dialog->text), FALSE);
+	gtk_text_buffer_set_text(gtk_text_view_get_buffer(
+		GTK_TEXT_VIEW(dialog->text)), report, -1);
+	dialog->entries[0] = gtk_check_button_new_with_label(
+		"Dry run (do not send the PHY configuration packet)");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dialog->entries[0]),
+		TRUE);
+
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog->dialog)->vbox),
+		dialog->text, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog->dialog)->vbox),
+		dialog->entries[0], FALSE, FALSE, 0);
+
+	transactionDialogAddOkClose(dialog, gapCountAppOk);
+
+	gtk_widget_show_all(dialog->dialog);
+}
+
+/*
+ * Forces the selected node to root from the root node dialog
+ * IN:		widget:	not used
+ * 		data:	the dialog
+ */
+void rootAdvisorAppOk(GtkWidget *widget, gpointer data) {
+	int phyID = -1;
+	char report[256];
+	TransactionDialog *dialog;
+
+	dialog = (TransactionDialog *) data;
+	if (topologyTree == NULL || refuseOnSnapshot()) return;
+
+	scanEditable(dialog->entries[0], "%i", &phyID);
+	rootAdvisorForce(handle, topologyTree, phyID, report, sizeof(report));
+	gtk_text_buffer_set_text(gtk_text_view_get_buffer(
+		GTK_TEXT_VIEW(dialog->text)), report, -1);
+}
+
+/*
+ * Callback for the choose root node menu item from the menu bar.
+ */
+static void rootAdvisorApp(gpointer callback_data, guint callback_action,
+	GtkWidget *widget) {
+	char report[4096], sbest[8] = "";
+	int best;
+	GtkWidget *table;
+	PangoFontDescription *font;
+	TransactionDialog *dialog;
+
+	if (topologyTree == NULL || refuseOnSnapshot()) return;
+	best = rootAdvisorReport(topologyTree, report, sizeof(report));
+	if (best >= 0) snprintf(sbest, sizeof(sbest), "%i", best);
+
+	dialog = makeTransactionDialog("Choose Root Node");
+	gtk_window_set_default_size(GTK_WINDOW(dialog->dialog), 450, 300);
+
+	dialog->text = gtk_text_view_new();
+	gtk_text_view_set_editable(GTK_TEXT_VIEW(dialog->text), FALSE);
+	font = pango_font_description_from_string("monospace");
+	gtk_widget_modify_font(dialog->text, font);
+	pango_font_description_free(font);
+	gtk_text_buffer_set_text(gtk_text_view_get_buffer(
+		GTK_TEXT_VIEW(dialog->text)), report, -1);
+
+	table = gtk_table_new(1, 3, FALSE);
+	dialog->entries[0] = tableAttachEntry(table, "Force root:", sbest, 0);
+
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog->dialog)->vbox),
+		dialog->text, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog->dialog)->vbox),
+		table, FALSE, FALSE, 0);
+
+	transactionDialogAddOkClose(dialog, rootAdvisorAppOk);
+
+	gtk_widget_show_all(dialog->dialog);
+}
+
+/*
+ * Callback for the zoom menu items from the menu bar.
+ * IN:		callback_action: 0 zoom in, 1 zoom out, 2 fit to window,
+ *				3 normal size
+ */
+static void viewApp(gpointer callback_data, guint callback_action,
+	GtkWidget *widget) {
+	int x = drawing_area->allocation.width / 2;
+	int y = drawing_area->allocation.height / 2;
+
+	switch (callback_action) {
+		case 0:
+			zoomView(1.25, x, y);
+			break;
+		case 1:
+			zoomView(1/1.25, x, y);
+			break;
+		case 2:
+			fitView(1);
+			break;
+		default:
+			fitView(0);
+			break;
+	}
+}
+
 /*
  * The data for the GtkItemFactory for the menu bar. This is the easy way to
  * create a menu bar in GTK+. Hopefully it is flexible enough for future
@@ -440,13 +803,29 @@ static void forceBusResetApp(gpointer callback_data, guint callback_action,
 static GtkItemFactoryEntry menu_items[] = {
 	{"/_File",		NULL,		0,	0,	"<Branch>" },
 	{"/File/tearoff1",	NULL,		0,	0,	"<Tearoff>" },
+	{"/File/_Open Snapshot...",	"<control>O",	openSnapshotApp,0, },
+	{"/File/_Save Snapshot...",	"<control>S",	saveSnapshotApp,0, },
+	{"/File/_Close Snapshot",	NULL,	closeSnapshotApp,0, },
+	{"/File/sep1",		NULL,		0,	0,	"<Separator>" },
+	{"/File/_Export Speed Map...",	NULL,	exportSpeedMapApp,0, },
 	{"/File/_Quit",		"<control>Q",	gtk_main_quit,0, },
 
+	{"/_View",		NULL,		0,	0,	"<Branch>" },
+	{"/View/tearoff1",	NULL,		0,	0,	"<Tearoff>" },
+	{"/View/Zoom _In",	"<control>plus",	viewApp,	0, },
+	{"/View/Zoom _Out",	"<control>minus",	viewApp,	1, },
+	{"/View/_Fit to Window",	"<control>F",	viewApp,	2, },
+	{"/View/_Normal Size",	"<control>0",	viewApp,	3, },
+
 	{"/_Control",		NULL,		0,	0,	"<Branch>" },
 	{"/Control/tearoff1",	NULL,		0,	0,	"<Tearoff>" },
 	/*{"/Control/Show _Bus Information...",	0,	0, },
 	{"/Control/Show _CSR Space...",		0,	0, },*/
 	{"/Control/Force Bus _Reset",		0,	forceBusResetApp, },
+	{"/Control/Rescan _All Nodes",		0,	rescanApp, },
+	{"/Control/Show _Speed Map...",		0,	showSpeedMapApp, },
+	{"/Control/Optimize _Gap Count...",	0,	gapCountApp, },
+	{"/Control/Choose _Root Node...",	0,	rootAdvisorApp, },
 
 	{"/_Transactions",	NULL,		0,	0,	"<Branch>" },
 	{"/Transactions/tearoff1",	NULL,	0,	0,	"<Tearoff>" },
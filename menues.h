@@ -41,6 +41,13 @@ void CloseDialog(GtkWidget *widget, gpointer data);
  */
 void ClosingDialog(GtkWidget *widget, gpointer data);
 
+/*
+ * Show a message in a non-modal dialog.
+ * IN:		type:		GTK_MESSAGE_INFO, GTK_MESSAGE_ERROR, etc.
+ * 		message:	the text to show
+ */
+void showMessage(GtkMessageType type, const char *message);
+
 /*
  * build the menu bar
  * IN:		window: pointer to the window. This is needed for adding
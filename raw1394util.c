@@ -35,6 +35,11 @@
 #define MAXTRIES 20
 #define DELAY 10000
 
+#define PHY_CONFIG_ROOT_ID(id)	((quadlet_t) ((id) & 0x3f) << 24)
+#define PHY_CONFIG_R		((quadlet_t) 1 << 23)
+#define PHY_CONFIG_T		((quadlet_t) 1 << 22)
+#define PHY_CONFIG_GAP_COUNT(g)	((quadlet_t) ((g) & 0x3f) << 16)
+
 int cooked1394_read(raw1394handle_t handle, nodeid_t node, nodeaddr_t addr,
                  size_t length, quadlet_t *buffer) {
 	int retval, i;
@@ -65,3 +70,20 @@ int cooked1394_write(raw1394handle_t handle, nodeid_t node, nodeaddr_t addr,
 	return retval;
 }
 
+
+int send_phy_config(raw1394handle_t handle, int root_id, int gap_count) {
+	quadlet_t data = 0;
+
+	if (root_id >= 0)
+		data |= PHY_CONFIG_ROOT_ID(root_id) | PHY_CONFIG_R;
+	if (gap_count >= 0)
+		data |= PHY_CONFIG_T | PHY_CONFIG_GAP_COUNT(gap_count);
+	if (data == 0) return 0;	/* nothing to configure */
+
+	DEBUG_LOWLEVEL fprintf(stderr, "PHY config packet: 0x%08x\n", data);
+	if (raw1394_phy_packet_write(handle, data) < 0) {
+		perror("Error while sending PHY configuration packet: ");
+		return -1;
+	}
+	return 0;
+}
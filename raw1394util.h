@@ -41,5 +41,16 @@ int cooked1394_read(raw1394handle_t handle, nodeid_t node, nodeaddr_t addr,
 int cooked1394_write(raw1394handle_t handle, nodeid_t node, nodeaddr_t addr,
                   size_t length, quadlet_t *data);
 
+/*
+ * Send a PHY configuration packet.
+ * IN:		handle:		the libraw1394 handle
+ *		root_id:	phyID of the node to force to become root, or
+ *				-1 to leave the root alone
+ *		gap_count:	new gap count for all PHYs, or -1 to leave the
+ *				gap count alone
+ * RETURNS:	0 on success, -1 on error
+ */
+int send_phy_config(raw1394handle_t handle, int root_id, int gap_count);
+
 #endif
 
@@ -32,7 +32,53 @@
 
 #define QUADINC(x) x = x + 4
 #define WARN(s, phyID, adr) fprintf(stderr,"%i/0x%08x%08x: %s\n",phyID,(int) (adr>>32), (int) adr,s)
-#define QUADREADERR(handle, phyID, offset, buf) if(cooked1394_read(handle, 0xffc0 | phyID, offset, 4, buf) < 0) WARN("read failed", phyID, offset);
+#define QUADREADERR(reader, offset, buf) if(rom_read(reader, offset, buf) < 0) WARN("read failed", (reader)->phyID, offset);
+
+/*
+ * Where the quadlets of a configuration ROM come from: a node on the bus or
+ * an image of the ROM in host byte order.
+ */
+typedef struct rom_reader_t {
+	raw1394handle_t	handle;
+	int		phyID;
+	quadlet_t	*image;
+	int		length;	/* of the image in quadlets */
+	quadlet_t	*record;	/* receives the quadlets read from the bus */
+	int		recordLength;
+} Rom_reader;
+
+/*
+ * Read a quadlet from a configuration ROM.
+ * IN:		reader:	where to read from
+ *		offset:	Memory offset to read from
+ * OUT:		quadlet:	the quadlet in host byte order
+ * RETURNS:	0 on success, -1 on error
+ */
+static int rom_read(Rom_reader *reader, octlet_t offset, quadlet_t *quadlet) {
+	octlet_t index;
+
+	if (reader->image != NULL) {
+		index = (offset - (CSR_REGISTER_BASE + CSR_CONFIG_ROM)) / 4;
+		if (offset < CSR_REGISTER_BASE + CSR_CONFIG_ROM
+			|| index >= reader->length) {
+			*quadlet = 0;
+			return -1;
+		}
+		*quadlet = reader->image[index];
+		return 0;
+	}
+	if (cooked1394_read(reader->handle, 0xffc0 | reader->phyID, offset, 4,
+		quadlet) < 0) return -1;
+	*quadlet = htonl(*quadlet);
+	index = (offset - (CSR_REGISTER_BASE + CSR_CONFIG_ROM)) / 4;
+	if (offset >= CSR_REGISTER_BASE + CSR_CONFIG_ROM
+		&& index < ROM_IMAGE_MAX) {
+		reader->record[index] = *quadlet;
+		if (index >= reader->recordLength)
+			reader->recordLength = index + 1;
+	}
+	return 0;
+}
 
 
 /*
@@ -58,6 +104,9 @@ void init_rom_info(Rom_info *rom_info) {
 	rom_info->textual_leafes = NULL;
 	rom_info->label = NULL;
 	rom_info->vendor = NULL;
+	rom_info->image = NULL;
+	rom_info->image_length = 0;
+	rom_info->image_owned = 0;
 }
 
 int check_guid_line(char *s) {
@@ -296,26 +345,29 @@ void get_guid(raw1394handle_t handle, int phyID,
 
 	if (cooked1394_read(handle, 0xffC0 | phyID, CSR_REGISTER_BASE
 		+ CSR_CONFIG_ROM + 0x10, 4, lo) < 0) { *hi=0; *lo=0; return; }
+
+	/* host byte order, like guid_hi and guid_lo of Rom_info */
+	*hi = htonl(*hi);
+	*lo = htonl(*lo);
 }
 
 /*
  * Read a textual leaf into a malloced ASCII string
  * TODO: This routine should probably care about character sets, Unicode, etc.
- * IN:		phyID:	Physical ID of the node to read from
+ * IN:		reader:	where to read from
  *		offset:	Memory offset to read from
  * RETURNS:	pointer to a freshly malloced string that contains the
  *		requested text or NULL if the text could not be read.
  */
-char *read_textual_leaf(raw1394handle_t handle, int phyID, octlet_t offset) {
+static char *read_textual_leaf(Rom_reader *reader, octlet_t offset) {
 	int i, length;
 	char *s;
 	quadlet_t quadlet;
 
 	DEBUG_CSR fprintf(stderr, "Reading textual leaf: %i 0x%08x%08x\n",
-		phyID, (unsigned int) (offset>>32),
+		reader->phyID, (unsigned int) (offset>>32),
 		(unsigned int) offset&0xFFFFFFFF);
-	QUADREADERR(handle, phyID, offset, &quadlet);
-	quadlet = htonl(quadlet);
+	QUADREADERR(reader, offset, &quadlet);
 	length = (quadlet >> 16) * 4;
 	DEBUG_CSR fprintf(stderr, "Textual leaf length: %i (0x%08X)\n",
 		length, length);
@@ -329,8 +381,7 @@ char *read_textual_leaf(raw1394handle_t handle, int phyID, octlet_t offset) {
 	for (i=0; i<length; i++) {
 		DEBUG_CSR fprintf(stderr,".");
 		QUADINC(offset);
-		QUADREADERR(handle, phyID, offset, &quadlet);
-		quadlet = htonl(quadlet);
+		QUADREADERR(reader, offset, &quadlet);
 		s[i] = quadlet>>24;
 		if (++i < length) s[i] = (quadlet>>16)&0xFF;
 		else break;
@@ -350,7 +401,7 @@ char *read_textual_leaf(raw1394handle_t handle, int phyID, octlet_t offset) {
 /*
  * Read a whole bunch of textual leafes from a node into an array of ASCII
  * strings.
- * IN:		phyID:		Physical ID of the node to read from
+ * IN:		reader:		where to read from
  *		offsets:	Memory offsets to read from
  *		n:		Number of Strings to read
  * RETURNS:	pointer to a freshly malloced array of freshly malloced
@@ -358,8 +409,8 @@ char *read_textual_leaf(raw1394handle_t handle, int phyID, octlet_t offset) {
  *		strings might be NULL however.
  *		Returns NULL when the number of textual leafes is 0.
  */
-char **read_textual_leafes(raw1394handle_t handle, int phyID,
-	octlet_t offsets[], int n) {
+static char **read_textual_leafes(Rom_reader *reader, octlet_t offsets[],
+	int n) {
 	int i;
 	char **textual_leafes;
 
@@ -367,8 +418,7 @@ char **read_textual_leafes(raw1394handle_t handle, int phyID,
 	if ((textual_leafes = (char **) calloc(n,sizeof(char *))) == NULL)
 		fatal("out of memory");
 	for (i=0; i<n; i++) {
-		textual_leafes[i] = read_textual_leaf(handle, phyID,
-			offsets[i]);
+		textual_leafes[i] = read_textual_leaf(reader, offsets[i]);
 	}
 	return textual_leafes;
 }
@@ -409,16 +459,12 @@ unsigned int determine_delay(raw1394handle_t handle, int phyID) {
 #endif
 
 /*
- * Read various information from the configuration ROM of a device into a
- * Rom_info struct.
- * IN:		phyID:		Physical ID of the node to read from
+ * Read various information from a configuration ROM into a Rom_info struct.
+ * IN:		reader:		where to read the ROM from
  *		rom_info:	Pointer to a structure to fill
  * RETURNS:	0 on success, -1 on error
- * NOTE:	Some strings may be malloced by this routine. free_rom_info
- *		should therefore be called, when the contents of this
- *		structure are no longer needed.
  */
-int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
+static int parse_rom_info(Rom_reader *reader, Rom_info *rom_info) {
 	int length, i, key, value, nr_textual_leafes;
 	octlet_t unit_directory = 0;
 	octlet_t textual_leafes[256];	/* FIXME */
@@ -427,32 +473,28 @@ int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
 	long long offset;
 
 	init_rom_info(rom_info);
-	DEBUG_CSR fprintf(stderr,"---------- PhyID: %i\n",phyID);
+	DEBUG_CSR fprintf(stderr,"---------- PhyID: %i\n",reader->phyID);
 
 	/* Read Bus Info Block */
 	offset = CSR_REGISTER_BASE + CSR_CONFIG_ROM;
-	DEBUG_CSR fprintf(stderr, "Reading Bus Info Block: %i 0x%08x\n", phyID,
-		(int) offset);
- 	QUADREADERR(handle, phyID, offset, &quadlet);
- 
-	quadlet = htonl(quadlet);
+	DEBUG_CSR fprintf(stderr, "Reading Bus Info Block: %i 0x%08x\n",
+		reader->phyID, (int) offset);
+ 	QUADREADERR(reader, offset, &quadlet);
 	length = quadlet>>24;
 	if (length != 4) {
-		WARN("wrong bus info block length",phyID, offset);
+		WARN("wrong bus info block length", reader->phyID, offset);
 		return -1;
 	}
 	QUADINC(offset);
-	QUADREADERR(handle, phyID, offset, &quadlet);
-	quadlet = htonl(quadlet);
+	QUADREADERR(reader, offset, &quadlet);
 	rom_info->magic = quadlet;
 	DEBUG_CSR fprintf(stderr, "Magic Quadlet: 0x%08x\n", quadlet);
 	if (rom_info->magic != 0x31333934) {
-		WARN("wrong magic quadlet: ",phyID, offset);
+		WARN("wrong magic quadlet: ", reader->phyID, offset);
 		return -1;
 	}
 	QUADINC(offset);
-	QUADREADERR(handle, phyID, offset, &quadlet);
-	quadlet = htonl(quadlet);
+	QUADREADERR(reader, offset, &quadlet);
 	rom_info->irmc = quadlet>>31;
 	rom_info->cmc = (quadlet>>30)&1;
 	rom_info->isc = (quadlet>>29)&1;
@@ -460,29 +502,25 @@ int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
 	rom_info->cyc_clk_acc = (quadlet>>16)&0xFF;
 	rom_info->max_rec = (quadlet>>12)&0xF;
 	QUADINC(offset);
-	QUADREADERR(handle, phyID, offset, &quadlet);
-	quadlet = htonl(quadlet);
+	QUADREADERR(reader, offset, &quadlet);
 	rom_info->guid_hi = quadlet;
 	QUADINC(offset);
-	QUADREADERR(handle, phyID, offset, &quadlet);
-	quadlet = htonl(quadlet);
+	QUADREADERR(reader, offset, &quadlet);
 	rom_info->guid_lo = quadlet;
 
 	/* Read Root Directory */
 	nr_textual_leafes = 0;
 	QUADINC(offset);
 
-	if (cooked1394_read(handle, 0xffc0 | phyID, offset, 4, &quadlet) < 0) {
-		WARN("read failed",phyID, offset);
+	if (rom_read(reader, offset, &quadlet) < 0) {
+		WARN("read failed", reader->phyID, offset);
 		return -1;
 	}
-	quadlet = htonl(quadlet);
 	length = quadlet>>16;
 	DEBUG_CSR fprintf(stderr, "Root Directory length: %i\n",length);
 	for (i=0; i<length; i++) {
 		QUADINC(offset);
-		QUADREADERR(handle, phyID, offset, &quadlet);
-		quadlet = htonl(quadlet);
+		QUADREADERR(reader, offset, &quadlet);
 		key = quadlet>>24;
 		value = quadlet&0x00FFFFFF;
 		DEBUG_LOWLEVEL fprintf(stderr,"key/value: 0x%02x 0x%06x\n",
@@ -493,6 +531,7 @@ int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
 			case 0x03:
 				rom_info->vendor_id = value; break;
 			case 0x81:
+				if (nr_textual_leafes == 256) break;
 				textual_leafes[nr_textual_leafes++] =
 					offset + value*4;
 				break;
@@ -508,24 +547,22 @@ int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
 	/* Read Unit Directory */
 	if (unit_directory != 0) {
 		DEBUG_CSR fprintf(stderr,
-			"Reading Unit directory: %i 0x%08x%08x\n", phyID,
+			"Reading Unit directory: %i 0x%08x%08x\n",
+			reader->phyID,
 			(unsigned int) (unit_directory>>32),
 			(unsigned int) unit_directory&0xFFFFFFFF);
 		offset = unit_directory;
 
-		if (cooked1394_read(handle, 0xffc0 | phyID, offset, 4, &quadlet)
-			< 0) {
-			WARN("read failed", phyID, offset);
+		if (rom_read(reader, offset, &quadlet) < 0) {
+			WARN("read failed", reader->phyID, offset);
 			return -1;
 		}
-		quadlet = htonl(quadlet);
 		length = quadlet>>16;
 		DEBUG_CSR fprintf(stderr, "Unit Directory length: %i\n",
 			length);
 		for (i=0; i<length; i++) {
 			QUADINC(offset);
-			QUADREADERR(handle, phyID, offset, &quadlet);
-			quadlet = htonl(quadlet);
+			QUADREADERR(reader, offset, &quadlet);
 			key = quadlet>>24;
 			value = quadlet&0x00FFFFFF;
 			switch (key) {
@@ -539,6 +576,7 @@ int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
 					rom_info->model_id = value;
 					break;
 				case 0xD1:
+					if (nr_textual_leafes == 256) break;
 					textual_leafes[nr_textual_leafes++] =
 						offset + value*4;
 					break;
@@ -551,7 +589,7 @@ int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
 
 	/* Read textual leafes */
 	rom_info->nr_textual_leafes = nr_textual_leafes;
-	rom_info->textual_leafes = read_textual_leafes(handle, phyID,
+	rom_info->textual_leafes = read_textual_leafes(reader,
 		textual_leafes, nr_textual_leafes);
 
 	/* Calculate label */
@@ -577,6 +615,97 @@ int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
 	return 0;
 }
 
+/*
+ * Read various information from the configuration ROM of a device into a
+ * Rom_info struct.
+ * IN:		phyID:		Physical ID of the node to read from
+ *		rom_info:	Pointer to a structure to fill
+ * RETURNS:	0 on success, -1 on error
+ * NOTE:	Some strings may be malloced by this routine. free_rom_info
+ *		should therefore be called, when the contents of this
+ *		structure are no longer needed.
+ */
+int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
+	Rom_reader reader;
+	int ret;
+
+	reader.handle = handle;
+	reader.phyID = phyID;
+	reader.image = NULL;
+	reader.length = 0;
+	reader.record = calloc(ROM_IMAGE_MAX, sizeof(quadlet_t));
+	if (!reader.record) fatal("out of memory!");
+	reader.recordLength = 0;
+	ret = parse_rom_info(&reader, rom_info);
+
+	/* Keep what was read, even of a broken ROM */
+	if (reader.recordLength == 0) {
+		free(reader.record);
+	} else {
+		rom_info->image = reader.record;
+		rom_info->image_length = reader.recordLength;
+		rom_info->image_owned = 1;
+	}
+	return ret;
+}
+
+/*
+ * Parse an image of a configuration ROM into a Rom_info struct, exactly like
+ * get_rom_info does with a ROM on the bus. The image is not copied, it must
+ * stay valid as long as the Rom_info is used.
+ * IN:		image:		the ROM quadlets in host byte order, starting
+ *				with the bus info block header
+ *		length:		number of quadlets in the image
+ *		rom_info:	Pointer to a structure to fill
+ * RETURNS:	0 on success, -1 on error
+ */
+int parse_rom_image(quadlet_t *image, int length, Rom_info *rom_info) {
+	Rom_reader reader;
+	int ret;
+
+	reader.handle = NULL;
+	reader.phyID = -1;
+	reader.image = image;
+	reader.length = length;
+	reader.record = NULL;
+	reader.recordLength = 0;
+	ret = parse_rom_info(&reader, rom_info);
+	rom_info->image = image;
+	rom_info->image_length = length;
+	return ret;
+}
+
+/*
+ * Make a deep copy of a Rom_info structure. The copy owns its textual
+ * leafes and its ROM image.
+ * IN:		dst:	the structure to fill
+ *		src:	the structure to copy
+ */
+void copy_rom_info(Rom_info *dst, Rom_info *src) {
+	int i;
+
+	*dst = *src;
+	if (src->textual_leafes != NULL) {
+		dst->textual_leafes = (char **) calloc(src->nr_textual_leafes,
+			sizeof(char *));
+		if (!dst->textual_leafes) fatal("out of memory!");
+		for (i=0; i<src->nr_textual_leafes; i++) {
+			if (src->textual_leafes[i] == NULL) continue;
+			dst->textual_leafes[i] = strdup(src->textual_leafes[i]);
+			if (!dst->textual_leafes[i]) fatal("out of memory!");
+			if (src->label == src->textual_leafes[i])
+				dst->label = dst->textual_leafes[i];
+		}
+	}
+	if (src->image != NULL) {
+		dst->image = malloc(src->image_length * sizeof(quadlet_t));
+		if (!dst->image) fatal("out of memory!");
+		memcpy(dst->image, src->image,
+			src->image_length * sizeof(quadlet_t));
+		dst->image_owned = 1;
+	}
+}
+
 /*
  * Free up all memory malloced by get_rom_info.
  * IN:  rom_info:	pointer to the Rom_info structure which is no longer
@@ -585,13 +714,18 @@ int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info) {
 void free_rom_info(Rom_info *rom_info) {
 	int i;
 
-	return;	//FIXME
-	if (rom_info == NULL || rom_info->textual_leafes == NULL) return;
+	if (rom_info == NULL) return;
+
+	if (rom_info->image_owned) free(rom_info->image);
+	rom_info->image = NULL;
+	rom_info->image_owned = 0;
 
+	if (rom_info->textual_leafes == NULL) return;
 	for (i=0; i<rom_info->nr_textual_leafes; i++) {
 		free(rom_info->textual_leafes[i]);
 	}
-	if (rom_info->textual_leafes != 0) free(rom_info->textual_leafes);
+	free(rom_info->textual_leafes);
 	rom_info->textual_leafes = 0;
+	rom_info->label = NULL;
 }
 
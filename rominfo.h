@@ -38,6 +38,8 @@
 #define NODE_TYPE_SBP2		3
 #define NODE_TYPE_CPU		4
 
+#define ROM_IMAGE_MAX		256	/* quadlets of config ROM space */
+
 /*
  * This structure holds various interesting data about a device which can be
  * obtained from the configuration rom
@@ -62,6 +64,9 @@ typedef struct rom_info_t {
 	char		*label;	/* aggregated from textual leafes */
 	char		*vendor;
 	int		node_type;	/* NODE_TYPE_AVC, etc. */
+	quadlet_t	*image;		/* the ROM quadlets that were parsed, */
+	int		image_length;	/* in host byte order */
+	int		image_owned;	/* image was malloced by get_rom_info */
 } Rom_info;
 
 /*
@@ -79,6 +84,14 @@ void init_rom_info(Rom_info *rom_info);
  */
 char *resolv_guid(int guid_hi, int guid_lo, char *cpu);
 
+/*
+ * Resolve a oui into a vendor name from the configuration file. Read in the
+ * file on first invocation
+ * IN:		oui:		vendor ID
+ * RETURNS:	Pointer to the vendor name string
+ */
+char *resolv_oui(int oui);
+
 /*
  * Get the type / protocol of a node
  * IN:		rom_info:	pointer to the Rom_info structure of the node
@@ -95,32 +108,10 @@ int get_node_type(Rom_info *rom_info);
  * IN:  phyID:	Physical ID of the node to read from
  *      hi:	Pointer to an integer which should receive the HI quadlet
  *      hi:	Pointer to an integer which should receive the LOW quadlet
+ *		Both are set to 0 if the ROM cannot be read.
  */
-/*void get_guid(raw1394handle_t handle, int phyID,
-	unsigned int *hi, unsigned int *lo);*/
-
-/*
- * Read a textual leaf into a malloced ASCII string
- * TODO: This routine should probably care about character sets, Unicode, etc.
- * IN:		phyID:	Physical ID of the node to read from
- *		offset:	Memory offset to read from
- * RETURNS:	pointer to a freshly malloced string that contains the
- *		requested text or NULL if the text could not be read.
- */
-/*char *read_textual_leaf(raw1394handle_t handle, int phyID, octlet_t offset);*/
-
-/*
- * Read a whole bunch of textual leafes from a node into an array of ASCII
- * strings.
- * IN:		phyID:		Physical ID of the node to read from
- *		offsets:	Memory offsets to read from
- *		n:		Number of Strings to read
- * RETURNS:	pointer to a freshly malloced array of freshly malloced
- *		strings that contains the requested texts. Some of the
- *		strings might be NULL however.
- */
-/*char **read_textual_leafes(raw1394handle_t handle, int phyID, octlet_t offsets[],
-	int n);*/
+void get_guid(raw1394handle_t handle, int phyID,
+	unsigned int *hi, unsigned int *lo);
 
 /*
  * Read various information from the configuration ROM of a device into a
@@ -134,6 +125,26 @@ int get_node_type(Rom_info *rom_info);
  */
 int get_rom_info(raw1394handle_t handle, int phyID, Rom_info *rom_info);
 
+/*
+ * Parse an image of a configuration ROM into a Rom_info struct, exactly like
+ * get_rom_info does with a ROM on the bus. The image is not copied, it must
+ * stay valid as long as the Rom_info is used.
+ * IN:		image:		the ROM quadlets in host byte order, starting
+ *				with the bus info block header
+ *		length:		number of quadlets in the image
+ *		rom_info:	Pointer to a structure to fill
+ * RETURNS:	0 on success, -1 on error
+ */
+int parse_rom_image(quadlet_t *image, int length, Rom_info *rom_info);
+
+/*
+ * Make a deep copy of a Rom_info structure. The copy owns its textual
+ * leafes and its ROM image.
+ * IN:		dst:	the structure to fill
+ *		src:	the structure to copy
+ */
+void copy_rom_info(Rom_info *dst, Rom_info *src);
+
 /*
  * Free up all memory malloced by get_rom_info.
  * IN:  rom_info:	pointer to the Rom_info structure which is no longer
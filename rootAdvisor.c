@@ -0,0 +1,165 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * rootAdvisor.c - cycle master placement advisor
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "rootAdvisor.h"
+
+/* cyc_clk_acc values above this are reserved or unspecified */
+#define MAX_CYC_CLK_ACC 100
+
+static int pendingRoot = 0;
+static quadlet_t pendingGuidHi, pendingGuidLo;
+static int pendingEccentricity;
+static unsigned int pendingGeneration;
+
+static int eccentricity(SpeedMap *speedMap, int node)
+{
+	int i, max = 0;
+
+	for (i=0; i < speedMap->nodeCount; i++)
+		if (speedMapHops(speedMap, node, i) > max)
+			max = speedMapHops(speedMap, node, i);
+	return max;
+}
+
+static int compareCandidates(const void *a, const void *b)
+{
+	const RootCandidate *ca = a, *cb = b;
+
+	if (ca->score != cb->score) return ca->score - cb->score;
+	return cb->phyID - ca->phyID;	/* prefer the node already near root */
+}
+
+int rootAdvisorRank(TopologyTree *topologyTree, RootCandidate *candidates)
+{
+	SpeedMap *speedMap = getSpeedMap(topologyTree);
+	Rom_info *rom_info;
+	int i, n = 0;
+
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		rom_info = &topologyTree->rom_info[i];
+		if (!topologyTree->selfid[i][0].packetZero.linkActive
+			|| !rom_info->cmc)
+			continue;
+		candidates[n].phyID = i;
+		candidates[n].eccentricity = eccentricity(speedMap, i);
+		candidates[n].accuracy = rom_info->cyc_clk_acc > MAX_CYC_CLK_ACC
+			? -1 : rom_info->cyc_clk_acc;
+		candidates[n].score = candidates[n].eccentricity * ROOT_HOP_WEIGHT
+			+ (candidates[n].accuracy < 0 ? ROOT_UNKNOWN_ACCURACY
+			: candidates[n].accuracy);
+		n++;
+	}
+	qsort(candidates, n, sizeof(RootCandidate), compareCandidates);
+	return n;
+}
+
+int rootAdvisorReport(TopologyTree *topologyTree, char *buf, int len)
+{
+	RootCandidate candidates[MAX_NODES];
+	int i, n, root, used;
+
+	root = topologyTreeRoot(topologyTree);
+	n = rootAdvisorRank(topologyTree, candidates);
+	used = snprintf(buf, len, "Current root: node %i (%s), hop radius %i\n\n"
+		"Node  Hops  Accuracy  Score  Label\n", root,
+		getNodeLabel(topologyTree, root),
+		eccentricity(getSpeedMap(topologyTree), root));
+	for (i=0; i < n && used < len; i++) {
+		char accuracy[16];
+
+		if (candidates[i].accuracy < 0)
+			snprintf(accuracy, sizeof(accuracy), "unknown");
+		else
+			snprintf(accuracy, sizeof(accuracy), "%i ppm",
+				candidates[i].accuracy);
+		used += snprintf(buf + used, len - used,
+			"%4i  %4i  %8s  %5i  %s%s\n",
+			candidates[i].phyID, candidates[i].eccentricity,
+			accuracy, candidates[i].score,
+			getNodeLabel(topologyTree, candidates[i].phyID),
+			candidates[i].phyID == root ? " (root)" : "");
+	}
+	if (n == 0 && used < len)
+		snprintf(buf + used, len - used,
+			"No cycle master capable node found.\n");
+	return n ? candidates[0].phyID : -1;
+}
+
+int rootAdvisorForce(raw1394handle_t handle, TopologyTree *topologyTree,
+	int phyID, char *buf, int len)
+{
+	Rom_info *rom_info;
+
+	if (phyID < 0 || phyID >= topologyTree->nodeCount) {
+		snprintf(buf, len, "There is no node %i.\n", phyID);
+		return -1;
+	}
+	rom_info = &topologyTree->rom_info[phyID];
+	if (!rom_info->cmc) {
+		snprintf(buf, len, "Node %i is not cycle master capable.\n",
+			phyID);
+		return -1;
+	}
+	if (send_phy_config(handle, phyID, -1) < 0) {
+		snprintf(buf, len,
+			"Sending the PHY configuration packet failed.\n");
+		return -1;
+	}
+	pendingRoot = 1;
+	pendingGuidHi = rom_info->guid_hi;
+	pendingGuidLo = rom_info->guid_lo;
+	pendingEccentricity = eccentricity(getSpeedMap(topologyTree), phyID);
+	pendingGeneration = topologyTree->generation;
+	raw1394_reset_bus(handle);
+	snprintf(buf, len, "Forcing node %i to root, bus reset initiated.\n"
+		"Expected hop radius: %i\n", phyID, pendingEccentricity);
+	return 0;
+}
+
+int rootAdvisorVerify(TopologyTree *topologyTree, char *buf, int len)
+{
+	Rom_info *rom_info;
+	int root, radius;
+
+	if (!pendingRoot || topologyTree == NULL) return 0;
+	if (topologyTree->generation == pendingGeneration) return 0;
+	pendingRoot = 0;
+
+	/* phyIDs change with the reset, so identify the root by its GUID */
+	root = topologyTreeRoot(topologyTree);
+	rom_info = &topologyTree->rom_info[root];
+	radius = eccentricity(getSpeedMap(topologyTree), root);
+	if (rom_info->guid_hi != pendingGuidHi
+		|| rom_info->guid_lo != pendingGuidLo) {
+		snprintf(buf, len, "Root verification failed: node %i "
+			"(GUID %08X%08X) is root, expected GUID %08X%08X.\n",
+			root, rom_info->guid_hi, rom_info->guid_lo,
+			pendingGuidHi, pendingGuidLo);
+		return -1;
+	}
+	if (radius != pendingEccentricity) {
+		snprintf(buf, len, "Root verified, but the hop radius is %i "
+			"instead of %i.\n", radius, pendingEccentricity);
+		return -1;
+	}
+	snprintf(buf, len, "Root node %i verified in generation %u, "
+		"hop radius %i.\n", root, topologyTree->generation, radius);
+	return 1;
+}
@@ -0,0 +1,74 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * rootAdvisor.h - cycle master placement advisor
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __ROOTADVISOR_H__
+#define __ROOTADVISOR_H__
+#include "topologyTree.h"
+#include "speedMap.h"
+#include "raw1394util.h"
+
+/* Penalty for each hop of eccentricity, in ppm of cycle clock accuracy */
+#define ROOT_HOP_WEIGHT 10
+/* Accuracy assumed for nodes that do not specify cyc_clk_acc */
+#define ROOT_UNKNOWN_ACCURACY 100
+
+/*
+ * A node that could be cycle master. The lower the score the better.
+ */
+typedef struct RootCandidate_t {
+	int	phyID;
+	int	eccentricity;	/* hop radius of the bus with this node as root */
+	int	accuracy;	/* cycle clock accuracy in ppm, -1 if unknown */
+	int	score;
+} RootCandidate;
+
+/*
+ * Score every cycle master capable node by its eccentricity in the tree and
+ * the accuracy of its cycle clock.
+ * IN:		topologyTree:	the current tree
+ * 		candidates:	array of MAX_NODES entries, filled out best
+ *				candidate first
+ * RETURNS:	the number of candidates
+ */
+int rootAdvisorRank(TopologyTree *topologyTree, RootCandidate *candidates);
+
+/*
+ * Describe the current root and the ranking of all candidates.
+ * RETURNS:	phyID of the best candidate, -1 if there is none
+ */
+int rootAdvisorReport(TopologyTree *topologyTree, char *buf, int len);
+
+/*
+ * Force a node to become root with a PHY configuration packet and reset the
+ * bus. The new root is remembered by its GUID and checked by
+ * rootAdvisorVerify after the reset.
+ * RETURNS:	0 on success, -1 on error
+ */
+int rootAdvisorForce(raw1394handle_t handle, TopologyTree *topologyTree,
+	int phyID, char *buf, int len);
+
+/*
+ * Verify the tree of a new generation against a previously forced root.
+ * RETURNS:	0 if nothing was pending, 1 if root and hop radius are as
+ *		predicted, -1 otherwise. The result is described in buf.
+ */
+int rootAdvisorVerify(TopologyTree *topologyTree, char *buf, int len);
+
+#endif
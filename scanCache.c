@@ -0,0 +1,153 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * scanCache.c - cache of configuration ROM scans keyed by bus topology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "scanCache.h"
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+#define SELFID_I_BIT	0x00000002	/* initiated reset, packet zero only */
+
+typedef struct ScanCacheEntry_t {
+	u_int64_t	fingerprint;
+	unsigned int	lastUse;	/* 0 = empty */
+	unsigned int	hits;
+	int		nodeCount;
+	Rom_info	rom_info[MAX_NODES];
+} ScanCacheEntry;
+
+static ScanCacheEntry scanCache[SCAN_CACHE_SIZE];
+static unsigned int useCounter = 0;
+
+u_int64_t topologyFingerprint(TopologyTree *topologyTree)
+{
+	u_int64_t hash = FNV_OFFSET;
+	quadlet_t quadlet;
+	int i, j, b;
+
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		for (j=0; j < 4; j++) {
+			quadlet = topologyTree->rawSelfId[i][j];
+			if (j == 0) quadlet &= ~SELFID_I_BIT;
+			for (b=0; b < 32; b += 8) {
+				hash ^= (quadlet >> b) & 0xFF;
+				hash *= FNV_PRIME;
+			}
+		}
+	}
+	return hash;
+}
+
+static void clearEntry(ScanCacheEntry *entry)
+{
+	int i;
+
+	for (i=0; i < entry->nodeCount; i++)
+		free_rom_info(&entry->rom_info[i]);
+	entry->lastUse = 0;
+	entry->nodeCount = 0;
+}
+
+static ScanCacheEntry *findEntry(TopologyTree *topologyTree)
+{
+	u_int64_t fingerprint = topologyFingerprint(topologyTree);
+	int i;
+
+	for (i=0; i < SCAN_CACHE_SIZE; i++) {
+		if (scanCache[i].lastUse
+			&& scanCache[i].fingerprint == fingerprint
+			&& scanCache[i].nodeCount == topologyTree->nodeCount)
+			return &scanCache[i];
+	}
+	return NULL;
+}
+
+/*
+ * Read back the GUIDs of a few nodes. A different node is checked first on
+ * every hit, so over time all nodes get checked.
+ * RETURNS:	non zero if all checked GUIDs match
+ */
+static int spotCheck(raw1394handle_t handle, ScanCacheEntry *entry)
+{
+	int i, n, checked = 0;
+	unsigned int hi, lo;
+	Rom_info *rom_info;
+
+	for (n=0; n < entry->nodeCount && checked < SCAN_CACHE_SPOT_CHECKS;
+		n++) {
+		i = (entry->hits + n) % entry->nodeCount;
+		rom_info = &entry->rom_info[i];
+		if (rom_info->magic != 0x31333934) continue;
+		get_guid(handle, i, &hi, &lo);
+		DEBUG_GENERAL fprintf(stderr, "spot check node %i: %08x%08x\n",
+			i, hi, lo);
+		if (hi != rom_info->guid_hi || lo != rom_info->guid_lo)
+			return 0;
+		checked++;
+	}
+	return 1;
+}
+
+int scanCacheRestore(raw1394handle_t handle, TopologyTree *topologyTree)
+{
+	ScanCacheEntry *entry;
+	int i;
+
+	if ((entry = findEntry(topologyTree)) == NULL) return 0;
+	if (!spotCheck(handle, entry)) {
+		DEBUG_GENERAL fprintf(stderr, "scan cache: spot check failed\n");
+		clearEntry(entry);
+		return 0;
+	}
+	entry->hits++;
+	entry->lastUse = ++useCounter;
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		free_rom_info(&topologyTree->rom_info[i]);
+		copy_rom_info(&topologyTree->rom_info[i], &entry->rom_info[i]);
+	}
+	return 1;
+}
+
+void scanCacheStore(TopologyTree *topologyTree)
+{
+	ScanCacheEntry *entry;
+	int i;
+
+	if ((entry = findEntry(topologyTree)) == NULL) {
+		entry = &scanCache[0];
+		for (i=1; i < SCAN_CACHE_SIZE; i++)
+			if (scanCache[i].lastUse < entry->lastUse)
+				entry = &scanCache[i];
+	}
+	clearEntry(entry);
+	entry->fingerprint = topologyFingerprint(topologyTree);
+	entry->lastUse = ++useCounter;
+	entry->hits = 0;
+	entry->nodeCount = topologyTree->nodeCount;
+	for (i=0; i < topologyTree->nodeCount; i++)
+		copy_rom_info(&entry->rom_info[i], &topologyTree->rom_info[i]);
+}
+
+void scanCacheFlush(void)
+{
+	int i;
+
+	for (i=0; i < SCAN_CACHE_SIZE; i++) clearEntry(&scanCache[i]);
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * scanCache.h - cache of configuration ROM scans keyed by bus topology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SCANCACHE_H__
+#define __SCANCACHE_H__
+#include "topologyTree.h"
+#include <sys/types.h>
+
+#define SCAN_CACHE_SIZE		8	/* bus configurations remembered */
+#define SCAN_CACHE_SPOT_CHECKS	2	/* GUIDs read back on a hit */
+
+/*
+ * Compute a 64 bit fingerprint of the self-IDs of a tree: phyIDs, port
+ * states, speeds, power classes, etc. The initiated reset bit is left out,
+ * since it changes with every reset.
+ */
+u_int64_t topologyFingerprint(TopologyTree *topologyTree);
+
+/*
+ * Look up the configuration ROMs of a bus with the same fingerprint. On a
+ * hit, the GUIDs of a few nodes are read back from the bus to make sure the
+ * same devices are still there, then copies of the cached Rom_info
+ * structures are filled into the tree.
+ * IN:		handle:		raw1394 handle for the spot check
+ *		topologyTree:	a tree built by spawnTopologyTreeShape
+ * RETURNS:	1 if the ROMs were restored from the cache, 0 otherwise
+ */
+int scanCacheRestore(raw1394handle_t handle, TopologyTree *topologyTree);
+
+/*
+ * Remember the configuration ROMs of a fully scanned tree. The least
+ * recently used entry is replaced when the cache is full.
+ */
+void scanCacheStore(TopologyTree *topologyTree);
+
+/*
+ * Forget all cached scans.
+ */
+void scanCacheFlush(void);
+
+#endif
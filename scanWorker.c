@@ -0,0 +1,196 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * scanWorker.c - background bus scanning
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "scanWorker.h"
+#include "scanCache.h"
+#include "syntheticBus.h"
+#include <errno.h>
+
+static raw1394handle_t workerHandle;
+static GAsyncQueue *requests;
+static GAsyncQueue *romUpdates;
+static GSourceFunc publishedCallback;
+static volatile gint flushPending = 0;
+static volatile gint wakeupPending = 0;
+static unsigned int scanCount = 0;
+
+/*
+ * The single slot through which trees are handed to the GUI. Only changed
+ * with compare and exchange, NULL when the GUI has taken the last tree.
+ */
+static volatile gpointer published = NULL;
+
+/*
+ * Wake up the GUI unless a wakeup is already pending. The GUI clears the
+ * flag in scanWorkerTake before it looks for new results.
+ */
+static void wakeup(void)
+{
+	if (g_atomic_int_compare_and_exchange(&wakeupPending, 0, 1))
+		g_idle_add(publishedCallback, NULL);
+}
+
+/*
+ * Hand a tree to the GUI. A tree the GUI has not taken yet is replaced.
+ */
+static void publish(TopologyTree *tree)
+{
+	gpointer old;
+
+	do {
+		old = g_atomic_pointer_get(&published);
+	} while (!g_atomic_pointer_compare_and_exchange(&published, old, tree));
+
+	if (old != NULL) freeTopologyTree((TopologyTree *) old);
+	wakeup();
+}
+
+/*
+ * Called after each ROM of a progressive scan. Sends a copy of the ROM to
+ * the GUI, and stops reading when another scan has been requested, since
+ * the bus has been reset then.
+ */
+static int romProgress(TopologyTree *tree, int node, void *data)
+{
+	RomUpdate *update;
+
+	if ((update = malloc(sizeof(RomUpdate))) == NULL)
+		fatal("out of memory!");
+	update->scan = tree->scan;
+	update->node = node;
+	copy_rom_info(&update->rom_info, &tree->rom_info[node]);
+	g_async_queue_push(romUpdates, update);
+	wakeup();
+	return g_async_queue_length(requests) > 0;
+}
+
+/*
+ * Publish the shape of a tree whose ROMs are about to be read, so the GUI
+ * can draw it right away. The ROMs follow one by one through romUpdates.
+ */
+static void publishShape(TopologyTree *tree)
+{
+	TopologyTree *shape;
+	int i;
+
+	if ((shape = malloc(sizeof(TopologyTree))) == NULL)
+		fatal("out of memory!");
+	/* The Rom_infos are still empty, so a flat copy will do */
+	memcpy(shape, tree, sizeof(TopologyTree));
+	for (i=0; i < shape->nodeCount; i++) {
+		if (shape->selfid[i][0].packetZero.linkActive) {
+			shape->romPending[i] = 1;
+			shape->romsPending++;
+		}
+	}
+	publish(shape);
+}
+
+static gpointer scanWorker(gpointer data)
+{
+	RAW1394topologyMap *topologyMap;
+	TopologyTree *tree;
+
+	for (;;) {
+		g_async_queue_pop(requests);
+		/* Merge the requests that queued up during the last scan */
+		while (g_async_queue_try_pop(requests) != NULL);
+		if (g_atomic_int_compare_and_exchange(&flushPending, 1, 0))
+			scanCacheFlush();
+
+		DEBUG_GENERAL fprintf(stderr, "scan worker: scanning\n");
+		topologyMap = raw1394GetTopologyMap(workerHandle);
+		/*topologyMap = generateTestTopologyMap(1, 7);*/
+		if (topologyMap == NULL) {
+			fprintf(stderr, "Could not read topologyMap\n");
+			continue;
+		}
+		tree = spawnTopologyTreeShape(topologyMap);
+		if (tree == NULL) {
+			fprintf(stderr, "Could not build topologyTree\n");
+			continue;
+		}
+		tree->scan = ++scanCount;
+		if (scanCacheRestore(workerHandle, tree)) {
+			publish(tree);
+			continue;
+		}
+
+		publishShape(tree);
+		if (readTopologyTreeRoms(workerHandle, tree, romProgress,
+			NULL) == 0)
+			scanCacheStore(tree);
+		freeTopologyTree(tree);
+	}
+	return NULL;
+}
+
+int scanWorkerStart(int port, GSourceFunc callback)
+{
+	char cpu;
+
+	workerHandle = raw1394_new_handle();
+	if (!workerHandle) return -1;
+	if (raw1394_set_port(workerHandle, port) < 0) {
+		raw1394_destroy_handle(workerHandle);
+		return -1;
+	}
+
+	/* Load the resolver tables now, they are only read afterwards */
+	resolv_guid(0, 0, &cpu);
+	resolv_oui(0);
+
+	publishedCallback = callback;
+	requests = g_async_queue_new();
+	romUpdates = g_async_queue_new();
+	if (g_thread_create(scanWorker, NULL, FALSE, NULL) == NULL) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return 0;
+}
+
+void scanWorkerRequest(void)
+{
+	g_async_queue_push(requests, GINT_TO_POINTER(1));
+}
+
+void scanWorkerFlushCache(void)
+{
+	g_atomic_int_set(&flushPending, 1);
+}
+
+TopologyTree *scanWorkerTake(void)
+{
+	gpointer tree;
+
+	g_atomic_int_set(&wakeupPending, 0);
+	do {
+		tree = g_atomic_pointer_get(&published);
+	} while (tree != NULL
+		&& !g_atomic_pointer_compare_and_exchange(&published, tree,
+		NULL));
+	return (TopologyTree *) tree;
+}
+
+RomUpdate *scanWorkerTakeRom(void)
+{
+	return (RomUpdate *) g_async_queue_try_pop(romUpdates);
+}
@@ -0,0 +1,77 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * scanWorker.h - background bus scanning
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SCANWORKER_H__
+#define __SCANWORKER_H__
+#include "topologyTree.h"
+#include "topologyMap.h"
+#include <glib.h>
+
+/*
+ * The configuration ROM of a node, read during a progressive scan.
+ */
+typedef struct RomUpdate_t {
+	unsigned int	scan;		/* the scan of the tree it belongs to */
+	int		node;
+	Rom_info	rom_info;
+} RomUpdate;
+
+/*
+ * Start the scan worker thread. It opens its own raw1394 handle, so the
+ * GUI thread never waits for the bus while a scan is running.
+ * IN:		port:		the card to use
+ *		callback:	called from the GLib main loop whenever a new
+ *				tree or ROM can be taken with scanWorkerTake
+ *				and scanWorkerTakeRom
+ * RETURNS:	0 on success, -1 on error (errno is set)
+ */
+int scanWorkerStart(int port, GSourceFunc callback);
+
+/*
+ * Ask the worker to scan the bus. Requests that arrive while a scan is
+ * running are merged into one more scan.
+ */
+void scanWorkerRequest(void);
+
+/*
+ * Make the worker forget the cached ROM scans before its next scan.
+ */
+void scanWorkerFlushCache(void);
+
+/*
+ * Take the most recently published tree. The caller owns the tree and has
+ * to free it with freeTopologyTree. Trees that are superseded before they
+ * are taken are freed by the worker. If the ROMs of the tree are still being
+ * read, romsPending is set and the ROMs follow through scanWorkerTakeRom.
+ * Call this first in the callback, before taking the ROMs.
+ * RETURNS:	the tree or NULL if nothing new has been published
+ */
+TopologyTree *scanWorkerTake(void);
+
+/*
+ * Take the next ROM read for a tree published while its ROMs were pending.
+ * ROMs of trees that have been superseded are delivered as well and have
+ * to be recognized by their scan number. The caller owns the update and
+ * its Rom_info.
+ * RETURNS:	the update or NULL if there is none
+ */
+RomUpdate *scanWorkerTakeRom(void);
+
+#endif
@@ -44,10 +44,96 @@
 #include <netinet/in.h>
 
 #include <stdio.h>	//DEBUG
+#include <poll.h>
+#include <limits.h>
 
+#ifndef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
 
-#define MAX_RESPONSE_SIZE 512
-unsigned char fcp_response[MAX_RESPONSE_SIZE];
+/*
+ * The commands that are waiting for their response. A response is matched
+ * to the oldest command to the same node that it echoes, e.g. an INQUIRY,
+ * then to the oldest command to the same node and subunit with the same
+ * opcode, or, since some responses carry a different opcode (e.g. the
+ * transport state of a VCR), to the oldest command to the same node and
+ * subunit.
+ * Every command has a deadline; when it passes, or the bus is reset, the
+ * command fails and its callback gets no response.
+ */
+typedef struct avc_pending_t {
+	unsigned int	id;		/* 0 = free slot */
+	nodeid_t	node;
+	quadlet_t	command;	/* first quadlet, host byte order */
+	quadlet_t	interim;	/* the INTERIM response, 0 if none */
+	long long	deadline;	/* msec, see avc_now */
+	avc_callback_t	callback;
+	void		*data;
+} avc_pending_t;
+
+static avc_pending_t avc_pending[AVC_MAX_PENDING];
+static unsigned int avc_next_id = 1;
+static raw1394handle_t avc_listening = NULL;
+static int avc_timeout = AVC_TIMEOUT;
+static int avc_interim_timeout = AVC_INTERIM_TIMEOUT;
+
+/*
+ * A state of a node that is tracked with NOTIFY commands, or polled with
+ * STATUS commands if the node does not support NOTIFY. All subscriptions
+ * to the same state share one watch, so the device sees a single NOTIFY or
+ * poll however many views show the state.
+ */
+typedef struct avc_watch_t {
+	int		users;		/* 0 = free slot */
+	raw1394handle_t	handle;
+	nodeid_t	node;
+	quadlet_t	guid_hi;	/* to find the node again after a */
+	quadlet_t	guid_lo;	/* bus reset */
+	quadlet_t	command;	/* STATUS form of the command */
+	int		request;	/* the outstanding command or 0 */
+	quadlet_t	state;		/* last response, 0 if unknown */
+	int		polling;	/* NOTIFY failed, poll instead */
+	int		interval;	/* msec between polls */
+	long long	next_poll;	/* msec, see avc_now */
+} avc_watch_t;
+
+typedef struct avc_subscription_t {
+	int		id;		/* 0 = free slot */
+	avc_watch_t	*watch;
+	avc_callback_t	callback;
+	void		*data;
+} avc_subscription_t;
+
+static avc_watch_t avc_watches[AVC_MAX_WATCHES];
+static avc_subscription_t avc_subscriptions[AVC_MAX_SUBSCRIPTIONS];
+static int avc_next_subscription = 1;
+static int avc_resetting = 0;
+
+/*
+ * RETURNS:	the current time in milliseconds
+ */
+static long long avc_now(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * Remove a command from the table and report to its callback.
+ * IN:		p:		the command
+ *		response:	the final response or NULL if it failed
+ *		len:		length of response in quadlets
+ */
+static void avc_complete(avc_pending_t *p, quadlet_t *response, int len) {
+	avc_pending_t done;
+
+	/* Free the slot first, the callback may submit the next command */
+	done = *p;
+	p->id = 0;
+	if (done.callback != NULL)
+		done.callback(done.node, response, len, done.data);
+}
 
 void htonl_block(quadlet_t *buf, int len) {
 	int i;
@@ -75,9 +161,73 @@ char *decode_response(quadlet_t response) {
 	return "huh?";
 }
 
+/*
+ * Choose between two commands in the same tier of avc_match: exact echo,
+ * same opcode or only the same subunit. The older command wins, but when
+ * fresh is set, one that has not had an INTERIM response wins first.
+ * IN:		p:	the command just found
+ *		q:	the command chosen so far or NULL
+ *		fresh:	the response is INTERIM, REJECTED or NOT_IMPLEMENTED
+ * RETURNS:	1 if p is the better choice
+ */
+static int avc_prefer(avc_pending_t *p, avc_pending_t *q, int fresh)
+{
+	if (q == NULL) return 1;
+	if (fresh && (p->interim == 0) != (q->interim == 0))
+		return p->interim == 0;
+	return p->id < q->id;
+}
+
+/*
+ * Find the pending command a response belongs to.
+ * RETURNS:	the pending command or NULL
+ */
+static avc_pending_t *avc_match(nodeid_t node, quadlet_t response)
+{
+	avc_pending_t *p, *exact = NULL, *best = NULL, *fallback = NULL;
+	int i, fresh;
+
+	/*
+	 * A parked NOTIFY is older than any STATUS to the same subunit, but
+	 * after its INTERIM only CHANGED answers it.
+	 */
+	fresh = AVC_MASK_RESPONSE(response) == AVC_RESPONSE_INTERIM
+		|| AVC_MASK_RESPONSE(response) == AVC_RESPONSE_REJECTED
+		|| AVC_MASK_RESPONSE(response) == AVC_RESPONSE_NOT_IMPLEMENTED;
+
+	for (i=0; i < AVC_MAX_PENDING; i++) {
+		p = &avc_pending[i];
+		if (p->id == 0 || p->node != node
+			|| (p->command & 0x00FF0000) != (response & 0x00FF0000))
+			continue;
+		/* CHANGED only answers a NOTIFY, STABLE never does */
+		if ((AVC_MASK_CTYPE(p->command) == AVC_CTYPE_NOTIFY)
+			!= (AVC_MASK_RESPONSE(response) == AVC_RESPONSE_CHANGED)
+			&& AVC_MASK_RESPONSE(response) != AVC_RESPONSE_INTERIM
+			&& AVC_MASK_RESPONSE(response) != AVC_RESPONSE_REJECTED
+			&& AVC_MASK_RESPONSE(response)
+				!= AVC_RESPONSE_NOT_IMPLEMENTED)
+			continue;
+		if ((p->command & 0x00FFFFFF) == (response & 0x00FFFFFF)) {
+			if (avc_prefer(p, exact, fresh)) exact = p;
+		} else if (AVC_MASK_OPCODE(p->command)
+			== AVC_MASK_OPCODE(response)) {
+			if (avc_prefer(p, best, fresh)) best = p;
+		} else {
+			if (avc_prefer(p, fallback, fresh)) fallback = p;
+		}
+	}
+	if (exact != NULL) return exact;
+	return (best != NULL) ? best : fallback;
+}
+
 int avc_fcp_handler(raw1394handle_t handle, nodeid_t nodeid, int response,
                    size_t length, unsigned char *data)
 {
+	quadlet_t frame[AVC_MAX_RESPONSE];
+	avc_pending_t *p;
+	int len;
+
 	DEBUG_LOWLEVEL {
 		unsigned char *pdata = data;
 		size_t length2 = length;
@@ -90,21 +240,407 @@ int avc_fcp_handler(raw1394handle_t handle, nodeid_t nodeid, int response,
         	fprintf(stderr, "\n");
 	}
 
-	if (response) {
-		memcpy(fcp_response, data, length);
+	if (!response || length < 4) return 0;
+
+	len = (length+3) / 4;
+	if (len > AVC_MAX_RESPONSE) len = AVC_MAX_RESPONSE;
+	memset(frame, 0, sizeof(frame));
+	memcpy(frame, data, MIN(length, sizeof(frame)));
+	ntohl_block(frame, len);
+
+	if ((p = avc_match(nodeid & 0x3f, frame[0])) == NULL) {
+		DEBUG_AVC fprintf(stderr, "AV/C response 0x%08X from node %d "
+			"matches no command\n", frame[0], nodeid & 0x3f);
+		return 0;
+	}
+	if (AVC_MASK_RESPONSE(frame[0]) == AVC_RESPONSE_INTERIM) {
+		if (AVC_MASK_CTYPE(p->command) == AVC_CTYPE_NOTIFY) {
+			/*
+			 * The INTERIM response to a NOTIFY carries the current
+			 * state, CHANGED follows whenever the state changes.
+			 */
+			p->deadline = LLONG_MAX;
+			if (p->callback != NULL)
+				p->callback(p->node, frame, len, p->data);
+		} else if (!p->interim) {
+			/*
+			 * The final response follows later, give it time, but
+			 * a repeated INTERIM does not extend the deadline.
+			 */
+			p->deadline = avc_now() + avc_interim_timeout;
+		}
+		p->interim = frame[0];
+		return 0;
 	}
 
+	avc_complete(p, frame, len);
 	return 0;
 }
 
-void init_avc_response_handler(raw1394handle_t handle) {
-	memset(fcp_response, 0, MAX_RESPONSE_SIZE);
+/*
+ * Start listening for FCP responses. The handler stays installed, so
+ * responses for different nodes and commands can arrive at any time.
+ */
+static void avc_listen(raw1394handle_t handle) {
+	if (avc_listening == handle) return;
 	raw1394_set_fcp_handler(handle, avc_fcp_handler);
 	raw1394_start_fcp_listen(handle);
+	avc_listening = handle;
+}
+
+int avc_submit(raw1394handle_t handle, nodeid_t node, quadlet_t *command,
+	int len, int timeout, avc_callback_t callback, void *data) {
+
+	quadlet_t frame[AVC_MAX_RESPONSE];
+	avc_pending_t *p = NULL;
+	int i;
+
+	if (len < 1 || len > AVC_MAX_RESPONSE) return -1;
+	for (i=0; i < AVC_MAX_PENDING; i++) {
+		if (avc_pending[i].id == 0) {
+			p = &avc_pending[i];
+			break;
+		}
+	}
+	if (p == NULL) {
+		fprintf(stderr, "Too many AV/C commands pending\n");
+		return -1;
+	}
+
+	avc_listen(handle);
+	memcpy(frame, command, len*4);
+	if (send_avc_command_block(handle, node, frame, len) < 0)
+		return -1;
+
+	p->id = avc_next_id++;
+	if (avc_next_id == 0) avc_next_id = 1;
+	p->node = node;
+	p->command = command[0];
+	p->interim = 0;
+	p->deadline = avc_now() + (timeout > 0 ? timeout : avc_timeout);
+	p->callback = callback;
+	p->data = data;
+	return p->id;
+}
+
+int avc_is_pending(int request) {
+	int i;
+
+	for (i=0; i < AVC_MAX_PENDING; i++)
+		if (avc_pending[i].id == (unsigned int) request) return 1;
+	return 0;
+}
+
+void avc_cancel(int request) {
+	int i;
+
+	for (i=0; i < AVC_MAX_PENDING; i++)
+		if (avc_pending[i].id == (unsigned int) request)
+			avc_pending[i].id = 0;
+}
+
+static void avc_watch_poll(long long now);
+
+void avc_set_timeouts(int timeout, int interim_timeout) {
+	if (timeout > 0) avc_timeout = timeout;
+	if (interim_timeout > 0) avc_interim_timeout = interim_timeout;
+}
+
+int avc_check_timeouts(void) {
+	long long now = avc_now(), next = -1;
+	avc_pending_t *p;
+	avc_watch_t *w;
+	int i;
+
+	for (i=0; i < AVC_MAX_PENDING; i++) {
+		p = &avc_pending[i];
+		if (p->id == 0) continue;
+		if (p->deadline <= now) {
+			DEBUG_AVC fprintf(stderr, "AV/C command 0x%08X to node "
+				"%d timed out%s\n", p->command, p->node,
+				p->interim ? " after INTERIM" : "");
+			avc_complete(p, NULL, 0);
+		}
+	}
+	avc_watch_poll(now);
+
+	/* Callbacks may have submitted new commands, look again */
+	for (i=0; i < AVC_MAX_WATCHES; i++) {
+		w = &avc_watches[i];
+		if (w->users != 0 && w->polling && w->request == 0
+			&& (next < 0 || w->next_poll - now < next))
+			next = w->next_poll - now;
+	}
+	for (i=0; i < AVC_MAX_PENDING; i++) {
+		p = &avc_pending[i];
+		if (p->id != 0 && p->deadline != LLONG_MAX
+			&& (next < 0 || p->deadline - now < next))
+			next = p->deadline - now;
+	}
+	if (next < 0) return -1;
+	return (next > 0) ? next : 0;
+}
+
+static void avc_watch_arm(avc_watch_t *watch);
+static void avc_watch_start_polling(avc_watch_t *watch);
+
+/*
+ * Report a new state of a watch to all its subscribers.
+ */
+static void avc_watch_fan_out(avc_watch_t *watch, quadlet_t *response,
+	int len) {
+
+	avc_subscription_t *sub;
+	int i;
+
+	for (i=0; i < AVC_MAX_SUBSCRIPTIONS; i++) {
+		sub = &avc_subscriptions[i];
+		if (sub->id != 0 && sub->watch == watch)
+			sub->callback(watch->node, response, len, sub->data);
+	}
+}
+
+/*
+ * Called with the responses to the NOTIFY command of a watch. INTERIM
+ * reports the current state, CHANGED a new one and requires a new NOTIFY.
+ */
+static void avc_watch_response(nodeid_t node, quadlet_t *response, int len,
+	void *data) {
+
+	avc_watch_t *watch = (avc_watch_t *) data;
+
+	if (response == NULL) {
+		watch->request = 0;
+		/* avc_bus_reset sends a new NOTIFY */
+		if (avc_resetting) return;
+		DEBUG_AVC fprintf(stderr, "NOTIFY 0x%08X to node %d got no "
+			"response\n", watch->command, node);
+		avc_watch_start_polling(watch);
+		watch->state = 0;
+		avc_watch_fan_out(watch, NULL, 0);
+		return;
+	}
+
+	switch (AVC_MASK_RESPONSE(response[0])) {
+	case AVC_RESPONSE_INTERIM:
+		break;
+	case AVC_RESPONSE_CHANGED:
+		watch->request = 0;
+		avc_watch_arm(watch);
+		break;
+	default:
+		/* REJECTED or NOT_IMPLEMENTED, the device cannot notify */
+		DEBUG_AVC fprintf(stderr, "NOTIFY 0x%08X to node %d not "
+			"accepted: 0x%08X, polling\n", watch->command, node,
+			response[0]);
+		watch->request = 0;
+		avc_watch_start_polling(watch);
+		return;
+	}
+	watch->state = response[0];
+	avc_watch_fan_out(watch, response, len);
+}
+
+/*
+ * Set the time of the next poll of a watch. Polls of different nodes are
+ * kept AVC_POLL_SPACING apart, so they do not arrive in bursts.
+ */
+static void avc_watch_schedule(avc_watch_t *watch, int interval) {
+	long long t = avc_now() + interval;
+	avc_watch_t *other;
+	int i, moved;
+
+	do {
+		moved = 0;
+		for (i=0; i < AVC_MAX_WATCHES; i++) {
+			other = &avc_watches[i];
+			if (other == watch || other->users == 0
+				|| !other->polling)
+				continue;
+			if (other->next_poll > t - AVC_POLL_SPACING
+				&& other->next_poll < t + AVC_POLL_SPACING) {
+				t = other->next_poll + AVC_POLL_SPACING;
+				moved = 1;
+			}
+		}
+	} while (moved);
+	watch->next_poll = t;
 }
 
-void stop_avc_response_handler(raw1394handle_t handle) {
-	raw1394_stop_fcp_listen(handle);
+static void avc_watch_start_polling(avc_watch_t *watch) {
+	watch->polling = 1;
+	watch->interval = AVC_POLL_MIN;
+	avc_watch_schedule(watch, 0);
+}
+
+/*
+ * Called with the response to a poll. Polls come quickly while the state
+ * changes and slow down while it stays the same.
+ */
+static void avc_poll_response(nodeid_t node, quadlet_t *response, int len,
+	void *data) {
+
+	avc_watch_t *watch = (avc_watch_t *) data;
+	quadlet_t state = (response != NULL) ? response[0] : 0;
+
+	watch->request = 0;
+	if (response == NULL && avc_resetting) return;
+
+	if (state != watch->state) {
+		watch->interval = AVC_POLL_MIN;
+	} else {
+		watch->interval *= 2;
+		if (watch->interval > AVC_POLL_MAX)
+			watch->interval = AVC_POLL_MAX;
+	}
+	avc_watch_schedule(watch, watch->interval);
+	if (state == watch->state) return;
+	watch->state = state;
+	avc_watch_fan_out(watch, response, len);
+}
+
+/*
+ * Send the polls that are due.
+ */
+static void avc_watch_poll(long long now) {
+	avc_watch_t *watch;
+	int i;
+
+	for (i=0; i < AVC_MAX_WATCHES; i++) {
+		watch = &avc_watches[i];
+		if (watch->users == 0 || !watch->polling
+			|| watch->request != 0 || watch->next_poll > now)
+			continue;
+		watch->request = avc_submit(watch->handle, watch->node,
+			&watch->command, 1, 0, avc_poll_response, watch);
+		if (watch->request < 0) {
+			watch->request = 0;
+			avc_watch_schedule(watch, watch->interval);
+		}
+	}
+}
+
+/*
+ * Send the NOTIFY command of a watch.
+ */
+static void avc_watch_arm(avc_watch_t *watch) {
+	quadlet_t command;
+
+	watch->polling = 0;
+	command = AVC_CTYPE_NOTIFY | (watch->command & ~0x0F000000);
+	watch->request = avc_submit(watch->handle, watch->node, &command, 1,
+		0, avc_watch_response, watch);
+	if (watch->request < 0) watch->request = 0;
+}
+
+int avc_subscribe(raw1394handle_t handle, nodeid_t node, quadlet_t guid_hi,
+	quadlet_t guid_lo, quadlet_t command, avc_callback_t callback,
+	void *data) {
+
+	avc_watch_t *watch = NULL, *free_watch = NULL;
+	avc_subscription_t *sub = NULL;
+	int i;
+
+	for (i=0; i < AVC_MAX_SUBSCRIPTIONS && sub == NULL; i++)
+		if (avc_subscriptions[i].id == 0) sub = &avc_subscriptions[i];
+	for (i=0; i < AVC_MAX_WATCHES; i++) {
+		if (avc_watches[i].users == 0) {
+			if (free_watch == NULL) free_watch = &avc_watches[i];
+		} else if (avc_watches[i].handle == handle
+			&& avc_watches[i].guid_hi == guid_hi
+			&& avc_watches[i].guid_lo == guid_lo
+			&& avc_watches[i].command == command) {
+			watch = &avc_watches[i];
+		}
+	}
+	if (sub == NULL || (watch == NULL && free_watch == NULL)) {
+		fprintf(stderr, "Too many AV/C subscriptions\n");
+		return -1;
+	}
+
+	sub->id = avc_next_subscription++;
+	sub->callback = callback;
+	sub->data = data;
+	if (watch == NULL) {
+		watch = free_watch;
+		watch->users = 1;
+		watch->handle = handle;
+		watch->node = node;
+		watch->guid_hi = guid_hi;
+		watch->guid_lo = guid_lo;
+		watch->command = command;
+		watch->state = 0;
+		sub->watch = watch;
+		avc_watch_arm(watch);
+	} else {
+		watch->users++;
+		sub->watch = watch;
+		if (watch->state != 0)
+			callback(node, &watch->state, 1, data);
+	}
+	return sub->id;
+}
+
+void avc_unsubscribe(int subscription) {
+	avc_subscription_t *sub;
+	avc_watch_t *watch;
+	int i;
+
+	for (i=0; i < AVC_MAX_SUBSCRIPTIONS; i++) {
+		sub = &avc_subscriptions[i];
+		if (sub->id != subscription || subscription <= 0) continue;
+		sub->id = 0;
+		watch = sub->watch;
+		if (--watch->users == 0 && watch->request != 0)
+			avc_cancel(watch->request);
+		return;
+	}
+}
+
+int avc_is_resetting(void) {
+	return avc_resetting;
+}
+
+void avc_bus_reset(void) {
+	int i;
+
+	/* Node IDs may have changed, no response can be trusted any more */
+	avc_resetting = 1;
+	for (i=0; i < AVC_MAX_PENDING; i++)
+		if (avc_pending[i].id != 0)
+			avc_complete(&avc_pending[i], NULL, 0);
+	avc_resetting = 0;
+
+	/*
+	 * The devices forget their NOTIFY commands on a reset. The watches
+	 * stay idle until avc_resubscribe has found their nodes again.
+	 */
+	for (i=0; i < AVC_MAX_WATCHES; i++)
+		avc_watches[i].polling = 0;
+}
+
+void avc_resubscribe(avc_lookup_t lookup, void *data) {
+	avc_watch_t *watch;
+	int i, node;
+
+	for (i=0; i < AVC_MAX_WATCHES; i++) {
+		watch = &avc_watches[i];
+		if (watch->users == 0 || watch->request != 0
+			|| watch->polling)
+			continue;
+		node = lookup(watch->guid_hi, watch->guid_lo, data);
+		if (node < 0) {
+			/* Unplugged, maybe it comes back with a later scan */
+			if (watch->state != 0) {
+				watch->state = 0;
+				avc_watch_fan_out(watch, NULL, 0);
+			}
+			continue;
+		}
+		watch->node = node;
+		/* The node may have been replaced by one that notifies */
+		avc_watch_arm(watch);
+	}
 }
 
 int send_avc_command(raw1394handle_t handle, nodeid_t node, quadlet_t command) {
@@ -133,6 +669,25 @@ int send_avc_command_block(raw1394handle_t handle, nodeid_t node,
 		command_len*4, command);
 }
 
+struct avc_wait {
+	int		done;		/* 1 = response, -1 = failed */
+	quadlet_t	*response;
+	int		len;
+};
+
+static void avc_wait_done(nodeid_t node, quadlet_t *response, int len,
+	void *data) {
+	struct avc_wait *wait = (struct avc_wait *) data;
+
+	if (response == NULL) {
+		wait->done = -1;
+		return;
+	}
+	memset(wait->response, 0, wait->len*4);
+	memcpy(wait->response, response, MIN(len, wait->len)*4);
+	wait->done = 1;
+}
+
 /*
  * Send an AV/C request to a device, wait for the corresponding AV/C
  * response and return that. This version only uses quadlet transactions.
@@ -146,75 +701,75 @@ int send_avc_command_block(raw1394handle_t handle, nodeid_t node,
 quadlet_t avc_transaction(raw1394handle_t handle, nodeid_t node,
 	quadlet_t quadlet, int retry) {
 
-	quadlet_t response;
+	quadlet_t *response;
 
-	init_avc_response_handler(handle);
+	response = avc_transaction_block(handle, node, &quadlet, 1, retry);
+	if (response == NULL) return -1;
+	return response[0];
+}
 
-	do {
-		if (send_avc_command(handle, node, quadlet) < 0) {
-			fprintf(stderr,"send oops\n");
-			usleep(10);
-			continue;
-		}
+/*
+ * Wait for events on the libraw1394 handle, at most timeout msec.
+ */
+static void avc_wait_event(raw1394handle_t handle, int timeout) {
+	struct pollfd pfd;
 
+	pfd.fd = raw1394_get_fd(handle);
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN))
 		raw1394_loop_iterate(handle);
-		response = ntohl(*((quadlet_t *)fcp_response));
-		while ((response & 0x0F000000) == 0x0F000000) {
-			fprintf(stderr,"INTERIM\n");
-			raw1394_loop_iterate(handle);
-			response = ntohl(*((quadlet_t *)fcp_response));
-		}
-		stop_avc_response_handler(handle);
-		/*fprintf(stderr, "avc_transaction: Got AVC response 0x%0x (%s)\n", response, decode_response(response));*/
-		return response;
-	} while (--retry >= 0);
-
-	stop_avc_response_handler(handle);
-
-	return -1;
 }
 
 /*
  * Send an AV/C request to a device, wait for the corresponding AV/C
  * response and return that. This version uses block transactions.
+ * Other commands submitted with avc_submit keep running while waiting.
+ * A request that gets no response before its deadline is retried. When
+ * the device answers INTERIM, the wait for the final response is bounded
+ * by the interim timeout (see avc_set_timeouts) and the request is not
+ * sent again, since the device has already accepted it. Callers that
+ * must not wait that long use avc_submit, whose callback gets the final
+ * response.
  * IN:		handle:		the libraw1394 handle
  *		node:		the phyisical ID of the node
  *		buf:	 	the FCP request to send
  *		len:		the length of the FCP request
  *		retry:		retry sending the request this many times
  * RETURNS:	the AV/C response if everything went well, NULL in case of an
- * 		error. The response always has the same length as the request.
+ * 		error. The response always has the same length as the request
+ *		and is overwritten by the next call.
  */
 quadlet_t *avc_transaction_block(raw1394handle_t handle, nodeid_t node,
 	quadlet_t *buf, int len, int retry) {
 
-	quadlet_t *response;
-	/*int i;*/
-
-	init_avc_response_handler(handle);
+	static quadlet_t response[AVC_MAX_RESPONSE];
+	struct avc_wait wait;
+	int i, id, next, interim;
 
+	if (len > AVC_MAX_RESPONSE) return NULL;
 	do {
-		if (send_avc_command_block(handle, node, buf, len) < 0) {
+		wait.done = 0;
+		wait.response = response;
+		wait.len = len;
+		if ((id = avc_submit(handle, node, buf, len, 0, avc_wait_done,
+			&wait)) < 0) {
 			fprintf(stderr,"send oops\n");
 			usleep(10);
 			continue;
 		}
 
-		raw1394_loop_iterate(handle);
-		response = (quadlet_t *)fcp_response;
-		while ((response[0] & 0x0F000000) == 0x0F000000) {
-			fprintf(stderr,"INTERIM\n");
-			raw1394_loop_iterate(handle);
-			response = (quadlet_t *)fcp_response;
+		interim = 0;
+		while (!wait.done) {
+			for (i=0; i < AVC_MAX_PENDING; i++)
+				if (avc_pending[i].id == (unsigned int) id
+					&& avc_pending[i].interim)
+					interim = 1;
+			next = avc_check_timeouts();
+			if (!wait.done) avc_wait_event(handle, next);
 		}
-		stop_avc_response_handler(handle);
-		ntohl_block(response, len);
-		/*fprintf(stderr, "avc_transaction_block received response: ");
-		for (i=0; i<len; i++) fprintf(stderr, " 0x%08X", response[i]);
-		fprintf(stderr, " (%s)\n", decode_response(response[0]));*/
-		return response;
+		if (wait.done > 0) return response;
+		if (interim) break;
 	} while (--retry >= 0);
-	stop_avc_response_handler(handle);
 	return NULL;
 }
 
@@ -320,30 +875,57 @@ unsigned char *avc_read_descriptor(raw1394handle_t handle, nodeid_t node,
 }
 
 /*
- * Get subunit info
+ * Get subunit info, one page after the other
  */
 #define EXTENSION_CODE 7
-int avc_subunit_info(raw1394handle_t handle, nodeid_t node, quadlet_t *table) {
+static int avc_subunit_info_page(avc_subunit_query_t *query);
 
-	quadlet_t request[2];
-	quadlet_t *response;
-	int page;
-
-	for (page=0; page < 8; page++) {
-		request[0] = AVC_CTYPE_STATUS | AVC_SUBUNIT_TYPE_UNIT
-			| AVC_SUBUNIT_ID_IGNORE | AVC_COMMAND_SUBUNIT_INFO
-			| page << 4 | EXTENSION_CODE;
-		request[1] = 0xFFFFFFFF;
-		response = avc_transaction_block(handle, node, request, 2, 3);
-		if (response == NULL) return -1;
-		table[page] = response[1];
+static void avc_subunit_info_done(nodeid_t node, quadlet_t *response, int len,
+	void *data) {
+
+	avc_subunit_query_t *query = (avc_subunit_query_t *) data;
+
+	query->request = -1;
+	if (response == NULL) {
+		query->callback(node, NULL, query->data);
+		return;
 	}
+	query->table[query->page] = (len > 1) ? response[1] : 0;
+	if (++query->page < 8) {
+		if (avc_subunit_info_page(query) < 0)
+			query->callback(node, NULL, query->data);
+		return;
+	}
+	query->callback(node, query->table, query->data);
+}
 
-	/*fprintf(stderr, "avc_subunit_info:");
-	for (page=0; page < 8; page++) fprintf(stderr, " 0x%08X", table[page]);
-	fprintf(stderr, "\n");*/
+static int avc_subunit_info_page(avc_subunit_query_t *query) {
+	quadlet_t request[2];
 
-	return 0;
+	request[0] = AVC_CTYPE_STATUS | AVC_SUBUNIT_TYPE_UNIT
+		| AVC_SUBUNIT_ID_IGNORE | AVC_COMMAND_SUBUNIT_INFO
+		| query->page << 4 | EXTENSION_CODE;
+	request[1] = 0xFFFFFFFF;
+	query->request = avc_submit(query->handle, query->node, request, 2, 0,
+		avc_subunit_info_done, query);
+	return query->request;
+}
+
+int avc_subunit_info(raw1394handle_t handle, nodeid_t node,
+	avc_subunit_query_t *query, avc_subunit_info_t callback, void *data) {
+
+	query->handle = handle;
+	query->node = node;
+	query->page = 0;
+	query->callback = callback;
+	query->data = data;
+	memset(query->table, 0, sizeof(query->table));
+	return avc_subunit_info_page(query) < 0 ? -1 : 0;
+}
+
+void avc_subunit_info_cancel(avc_subunit_query_t *query) {
+	if (query->request >= 0) avc_cancel(query->request);
+	query->request = -1;
 }
 
 quadlet_t *avc_unit_info(raw1394handle_t handle, nodeid_t node) {
@@ -250,6 +250,128 @@
 #define DVCR_RELATIVE_TIME_COUNTER
 #endif
 
+#define AVC_MAX_PENDING 64	/* commands in flight, all nodes together */
+#define AVC_MAX_RESPONSE 128	/* quadlets, an FCP frame has 512 bytes */
+#define AVC_TIMEOUT 500		/* msec until the first response */
+#define AVC_INTERIM_TIMEOUT 10000 /* msec from INTERIM to the final response */
+#define AVC_MAX_WATCHES 16	/* states tracked with NOTIFY */
+#define AVC_MAX_SUBSCRIPTIONS 64	/* views of these states */
+#define AVC_POLL_MIN 250	/* msec between polls while the state changes */
+#define AVC_POLL_MAX 4000	/* msec between polls while it does not */
+#define AVC_POLL_SPACING 20	/* msec between polls of different nodes */
+
+/*
+ * Called from raw1394_loop_iterate when the final response to a submitted
+ * command has arrived, or from avc_check_timeouts and avc_bus_reset when
+ * the command failed. INTERIM responses are only reported for NOTIFY
+ * commands, which stay pending until the state changes.
+ * IN:		node:		the phyisical ID of the node
+ *		response:	the response in host byte order, NULL if the
+ *				command timed out or was lost in a bus reset
+ *		len:		length of the response in quadlets
+ *		data:		as given to avc_submit
+ */
+typedef void (*avc_callback_t)(nodeid_t node, quadlet_t *response, int len,
+	void *data);
+
+/*
+ * Send an AV/C command without waiting for the response. Commands to
+ * several nodes, and to different subunits of a node, can be in flight at
+ * the same time; responses are delivered while libraw1394 events are
+ * processed.
+ * IN:		handle:		the libraw1394 handle
+ *		node:		the phyisical ID of the node
+ *		command:	the FCP frame in host byte order
+ *		len:		length of the frame in quadlets
+ *		timeout:	msec to wait for the response, 0 for the
+ *				default set with avc_set_timeouts
+ *		callback:	called with the response, may be NULL
+ *		data:		passed to callback
+ * RETURNS:	an id for the request, -1 if it could not be sent
+ */
+int avc_submit(raw1394handle_t handle, nodeid_t node, quadlet_t *command,
+	int len, int timeout, avc_callback_t callback, void *data);
+
+/*
+ * RETURNS:	1 if the request is still waiting for its response, 0 if it
+ *		has completed or was cancelled
+ */
+int avc_is_pending(int request);
+
+/*
+ * Forget a request, its response will be ignored.
+ */
+void avc_cancel(int request);
+
+/*
+ * Set the default time to wait for a response and the time a device may
+ * take after answering INTERIM. Values <= 0 leave the setting unchanged.
+ */
+void avc_set_timeouts(int timeout, int interim_timeout);
+
+/*
+ * Fail the commands whose deadline has passed and send the status polls
+ * that are due. Must be called again when the returned time has passed.
+ * RETURNS:	msec until the next deadline or poll, -1 if there is none
+ */
+int avc_check_timeouts(void);
+
+/*
+ * Fail all pending commands, to be called on a bus reset. The
+ * subscriptions send nothing until avc_resubscribe.
+ */
+void avc_bus_reset(void);
+
+/*
+ * RETURNS:	1 while avc_bus_reset is failing the pending commands, so
+ *		callbacks can tell a bus reset from a device that does not
+ *		answer
+ */
+int avc_is_resetting(void);
+
+/*
+ * Track a state of a node, e.g. the transport state of a VCR, with NOTIFY
+ * commands. Subscriptions to the same state share one NOTIFY, which is
+ * sent again every time the state changes, so nothing goes over the bus
+ * while the state stays the same. Nodes that do not accept the NOTIFY are
+ * polled instead, from avc_check_timeouts: once for all subscriptions,
+ * staggered across nodes, and less often while the state stays the same.
+ * IN:		handle:		the libraw1394 handle
+ *		node:		the phyisical ID of the node
+ *		guid_hi:	the GUID of the node, to find it again
+ *		guid_lo:	after a bus reset
+ *		command:	the STATUS command that queries the state
+ *		callback:	called with every new state as a response to
+ *				the command, NULL when the node does not
+ *				answer. It is called at once if the state is
+ *				known already.
+ *		data:		passed to callback
+ * RETURNS:	an id for the subscription, -1 on error
+ */
+int avc_subscribe(raw1394handle_t handle, nodeid_t node, quadlet_t guid_hi,
+	quadlet_t guid_lo, quadlet_t command, avc_callback_t callback,
+	void *data);
+
+/*
+ * End a subscription. The NOTIFY or poll stops with the last subscription.
+ */
+void avc_unsubscribe(int subscription);
+
+/*
+ * Find the phyID of a node after a bus reset.
+ * RETURNS:	the phyID of the node with that GUID, -1 if there is none
+ */
+typedef int (*avc_lookup_t)(quadlet_t guid_hi, quadlet_t guid_lo,
+	void *data);
+
+/*
+ * Send the NOTIFY commands again after a bus reset, once the new phyIDs
+ * are known. Subscribers of nodes that are gone get a NULL response.
+ * IN:		lookup:	maps the GUID of a node to its new phyID
+ *		data:	passed to lookup
+ */
+void avc_resubscribe(avc_lookup_t lookup, void *data);
+
 int send_avc_command(raw1394handle_t handle, nodeid_t node, quadlet_t command);
 
 int send_avc_command_block(raw1394handle_t handle, nodeid_t node,
@@ -275,7 +397,45 @@ int avc_close_descriptor(raw1394handle_t handle, nodeid_t node,
 	quadlet_t ctype, quadlet_t subunit,
 	unsigned char *descriptor_identifier, int len_descriptor_identifier);
 
-int avc_subunit_info(raw1394handle_t handle, nodeid_t node, quadlet_t *table);
+/*
+ * Called when all pages of the subunit info have arrived.
+ * IN:		node:		the phyisical ID of the node
+ *		table:		the 8 pages, NULL if a page could not be read
+ *		data:		as given to avc_subunit_info
+ */
+typedef void (*avc_subunit_info_t)(nodeid_t node, quadlet_t *table,
+	void *data);
+
+/*
+ * A subunit info query in flight, owned by the caller.
+ */
+typedef struct avc_subunit_query {
+	raw1394handle_t		handle;
+	nodeid_t		node;
+	int			page;
+	int			request;	/* -1 if none */
+	quadlet_t		table[8];
+	avc_subunit_info_t	callback;
+	void			*data;
+} avc_subunit_query_t;
+
+/*
+ * Read the subunit info of a node without waiting. The pages are sent
+ * with avc_submit one after the other, so a device that does not answer
+ * or stays INTERIM never blocks the caller.
+ * IN:		query:		kept until the callback was called or the
+ *				query was cancelled
+ *		callback:	called once, from avc_submit's callbacks
+ * RETURNS:	0 if the first page was sent, -1 otherwise; the callback is
+ *		not called then
+ */
+int avc_subunit_info(raw1394handle_t handle, nodeid_t node,
+	avc_subunit_query_t *query, avc_subunit_info_t callback, void *data);
+
+/*
+ * Stop a subunit info query, its callback will not be called.
+ */
+void avc_subunit_info_cancel(avc_subunit_query_t *query);
 
 quadlet_t *avc_unit_info(raw1394handle_t handle, nodeid_t node);
 
@@ -0,0 +1,288 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * snapshot.c - versioned binary snapshots of the bus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "snapshot.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAP_HEADER_SIZE	12	/* length, crc, generation, counts */
+
+static void putLe16(FILE *file, u_int16_t value)
+{
+	value = htole16(value);
+	fwrite(&value, sizeof(value), 1, file);
+}
+
+static void putLe32(FILE *file, u_int32_t value)
+{
+	value = htole32(value);
+	fwrite(&value, sizeof(value), 1, file);
+}
+
+static void putLe64(FILE *file, u_int64_t value)
+{
+	value = htole64(value);
+	fwrite(&value, sizeof(value), 1, file);
+}
+
+/*
+ * RETURNS:	number of self-ID packets of a node
+ */
+static int selfIdPackets(TopologyTree *topologyTree, int node)
+{
+	int n = 1;
+
+	while (n < 4 && topologyTree->selfid[node][n-1].packetZero.morePackets)
+		n++;
+	return n;
+}
+
+int writeSnapshot(const char *filename, TopologyTree *topologyTree)
+{
+	FILE *file;
+	int i, j, selfIdCount = 0;
+	u_int32_t romOffset;
+	Rom_info *rom_info;
+
+	for (i=0; i < topologyTree->nodeCount; i++)
+		selfIdCount += selfIdPackets(topologyTree, i);
+
+	if ((file = fopen(filename, "wb")) == NULL) return -1;
+
+	/* Header */
+	fwrite(SNAPSHOT_MAGIC, 4, 1, file);
+	putLe16(file, SNAPSHOT_VERSION);
+	putLe16(file, sizeof(SnapshotHeader));
+	putLe32(file, topologyTree->generation);
+	putLe32(file, topologyTree->nodeCount);
+	putLe64(file, topologyTree->timestamp);
+	putLe32(file, sizeof(SnapshotHeader));
+	putLe32(file, sizeof(SnapshotHeader) + MAP_HEADER_SIZE
+		+ selfIdCount * 4);
+
+	/* Topology map */
+	putLe16(file, selfIdCount + 2);
+	putLe16(file, topologyTree->mapCrc);
+	putLe32(file, topologyTree->generation);
+	putLe16(file, topologyTree->nodeCount);
+	putLe16(file, selfIdCount);
+	for (i=0; i < topologyTree->nodeCount; i++)
+		for (j=0; j < selfIdPackets(topologyTree, i); j++)
+			putLe32(file, topologyTree->rawSelfId[i][j]);
+
+	/* ROM table */
+	romOffset = sizeof(SnapshotHeader) + MAP_HEADER_SIZE + selfIdCount * 4
+		+ topologyTree->nodeCount * sizeof(SnapshotRom);
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		rom_info = &topologyTree->rom_info[i];
+		putLe32(file, rom_info->image_length ? romOffset : 0);
+		putLe32(file, rom_info->image_length);
+		romOffset += rom_info->image_length * 4;
+	}
+
+	/* ROM images */
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		rom_info = &topologyTree->rom_info[i];
+		for (j=0; j < rom_info->image_length; j++)
+			putLe32(file, rom_info->image[j]);
+	}
+
+	if (ferror(file)) {
+		fclose(file);
+		errno = EIO;
+		return -1;
+	}
+	return fclose(file);
+}
+
+/*
+ * Check that everything the header and the ROM table refer to lies within
+ * the file and that the self-IDs do not run past the end of the map.
+ * RETURNS:	NULL if the snapshot is valid, a description of the problem
+ *		otherwise
+ */
+static char *checkSnapshot(Snapshot *snapshot)
+{
+	SnapshotHeader *header = &snapshot->header;
+	size_t mapEnd, romEnd;
+	int i, selfIdCount, n;
+	quadlet_t *selfId;
+
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, 4) != 0)
+		return "not a snapshot file";
+	if (header->version != SNAPSHOT_VERSION)
+		return "unsupported snapshot version";
+	if (header->headerSize < sizeof(SnapshotHeader)
+		|| header->headerSize > snapshot->size)
+		return "bad header size";
+	if (header->nodeCount < 1 || header->nodeCount >= MAX_NODES)
+		return "bad node count";
+	if (header->mapOffset % 4 || header->mapOffset < header->headerSize
+		|| (size_t) header->mapOffset + MAP_HEADER_SIZE
+		> snapshot->size)
+		return "bad topology map offset";
+
+	if (le16toh(*(u_int16_t *) (snapshot->base + header->mapOffset + 8))
+		!= header->nodeCount)
+		return "node counts do not match";
+	selfIdCount = le16toh(*(u_int16_t *) (snapshot->base
+		+ header->mapOffset + 10));
+	mapEnd = (size_t) header->mapOffset + MAP_HEADER_SIZE
+		+ (size_t) selfIdCount * 4;
+	if (mapEnd > snapshot->size) return "truncated topology map";
+	selfId = (quadlet_t *) (snapshot->base + header->mapOffset
+		+ MAP_HEADER_SIZE);
+	for (i=0, n=0; i < selfIdCount; i++, n++) {
+		while (le32toh(selfId[i]) & 1)	/* more packets */
+			if (++i >= selfIdCount) return "truncated self-ID";
+	}
+	if (n < header->nodeCount) return "too few self-IDs";
+
+	if (header->romTableOffset % 4 || header->romTableOffset < mapEnd
+		|| (size_t) header->romTableOffset + (size_t) header->nodeCount
+		* sizeof(SnapshotRom) > snapshot->size)
+		return "bad ROM table offset";
+	snapshot->roms = (SnapshotRom *) (snapshot->base
+		+ header->romTableOffset);
+	for (i=0; i < header->nodeCount; i++) {
+		if (le32toh(snapshot->roms[i].length) == 0) continue;
+		romEnd = (size_t) le32toh(snapshot->roms[i].offset)
+			+ (size_t) le32toh(snapshot->roms[i].length) * 4;
+		if (le32toh(snapshot->roms[i].offset) % 4
+			|| le32toh(snapshot->roms[i].length) > ROM_IMAGE_MAX
+			|| romEnd > snapshot->size)
+			return "bad ROM image";
+	}
+	return NULL;
+}
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+/*
+ * Convert the map, the ROM table and the ROM images to host byte order.
+ * This touches only the private copy-on-write mapping, not the file.
+ */
+static void swapSnapshot(Snapshot *snapshot)
+{
+	RAW1394topologyMap *map = snapshot->map;
+	quadlet_t *quadlet;
+	int i, j;
+
+	map->length = le16toh(map->length);
+	map->crc = le16toh(map->crc);
+	map->generationNumber = le32toh(map->generationNumber);
+	map->nodeCount = le16toh(map->nodeCount);
+	map->selfIdCount = le16toh(map->selfIdCount);
+	quadlet = (quadlet_t *) map->selfIdPacket;
+	for (i=0; i < map->selfIdCount; i++)
+		quadlet[i] = le32toh(quadlet[i]);
+	for (i=0; i < snapshot->header.nodeCount; i++) {
+		snapshot->roms[i].offset = le32toh(snapshot->roms[i].offset);
+		snapshot->roms[i].length = le32toh(snapshot->roms[i].length);
+		quadlet = (quadlet_t *) (snapshot->base
+			+ snapshot->roms[i].offset);
+		for (j=0; j < snapshot->roms[i].length; j++)
+			quadlet[j] = le32toh(quadlet[j]);
+	}
+}
+#endif
+
+Snapshot *openSnapshot(const char *filename)
+{
+	Snapshot *snapshot;
+	SnapshotHeader *raw;
+	struct stat st;
+	char *error;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		perror(filename);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(SnapshotHeader)) {
+		fprintf(stderr, "%s: not a snapshot file\n", filename);
+		close(fd);
+		return NULL;
+	}
+	snapshot = malloc(sizeof(Snapshot));
+	if (!snapshot) fatal("out of memory!");
+	snapshot->size = st.st_size;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	snapshot->base = mmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE,
+		fd, 0);
+#else
+	snapshot->base = mmap(NULL, snapshot->size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE, fd, 0);
+#endif
+	close(fd);
+	if (snapshot->base == MAP_FAILED) {
+		perror(filename);
+		free(snapshot);
+		return NULL;
+	}
+
+	raw = (SnapshotHeader *) snapshot->base;
+	memcpy(snapshot->header.magic, raw->magic, 4);
+	snapshot->header.version = le16toh(raw->version);
+	snapshot->header.headerSize = le16toh(raw->headerSize);
+	snapshot->header.generation = le32toh(raw->generation);
+	snapshot->header.nodeCount = le32toh(raw->nodeCount);
+	snapshot->header.timestamp = le64toh(raw->timestamp);
+	snapshot->header.mapOffset = le32toh(raw->mapOffset);
+	snapshot->header.romTableOffset = le32toh(raw->romTableOffset);
+
+	if ((error = checkSnapshot(snapshot)) != NULL) {
+		fprintf(stderr, "%s: %s\n", filename, error);
+		closeSnapshot(snapshot);
+		return NULL;
+	}
+	snapshot->map = (RAW1394topologyMap *) (snapshot->base
+		+ snapshot->header.mapOffset);
+#if __BYTE_ORDER == __BIG_ENDIAN
+	swapSnapshot(snapshot);
+#endif
+	return snapshot;
+}
+
+TopologyTree *spawnSnapshotTopologyTree(Snapshot *snapshot)
+{
+	TopologyTree *topologyTree;
+	int i;
+
+	topologyTree = spawnTopologyTreeShape(snapshot->map);
+	if (topologyTree == NULL) return NULL;
+	topologyTree->timestamp = snapshot->header.timestamp;
+	for (i=0; i < topologyTree->nodeCount
+		&& i < snapshot->header.nodeCount; i++) {
+		if (snapshot->roms[i].length == 0) continue;
+		parse_rom_image((quadlet_t *) (snapshot->base
+			+ snapshot->roms[i].offset), snapshot->roms[i].length,
+			&topologyTree->rom_info[i]);
+	}
+	return topologyTree;
+}
+
+void closeSnapshot(Snapshot *snapshot)
+{
+	munmap(snapshot->base, snapshot->size);
+	free(snapshot);
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * snapshot.h - versioned binary snapshots of the bus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+#include "topologyTree.h"
+#include <sys/types.h>
+
+#define SNAPSHOT_MAGIC		"GSBS"
+#define SNAPSHOT_VERSION	1
+
+/*
+ * A snapshot file holds the raw topology map and the raw configuration ROM
+ * images of one bus generation. All fields are little endian:
+ *
+ *	SnapshotHeader
+ *	topology map:	the leading fields of RAW1394topologyMap, i.e.
+ *			u16 length, u16 crc, u32 generationNumber,
+ *			u16 nodeCount, u16 selfIdCount,
+ *			u32 selfIdPacket[selfIdCount]
+ *	ROM table:	nodeCount SnapshotRom entries, indexed by phyID
+ *	ROM images:	u32 quadlets, referenced by the ROM table
+ *
+ * Readers must reject versions they do not know. headerSize allows later
+ * versions to append fields to the header.
+ */
+typedef struct SnapshotHeader_t {
+	char		magic[4];
+	u_int16_t	version;
+	u_int16_t	headerSize;
+	u_int32_t	generation;
+	u_int32_t	nodeCount;
+	u_int64_t	timestamp;	/* seconds since the epoch */
+	u_int32_t	mapOffset;
+	u_int32_t	romTableOffset;
+} SnapshotHeader;
+
+typedef struct SnapshotRom_t {
+	u_int32_t	offset;		/* in bytes from the start of the file */
+	u_int32_t	length;		/* in quadlets, 0 = no ROM */
+} SnapshotRom;
+
+/*
+ * An opened snapshot. The file is mapped into memory and used in place.
+ */
+typedef struct Snapshot_t {
+	char			*base;
+	size_t			size;
+	SnapshotHeader		header;		/* decoded */
+	RAW1394topologyMap	*map;		/* points into the mapping */
+	SnapshotRom		*roms;		/* points into the mapping */
+} Snapshot;
+
+/*
+ * Save the topology map and the ROM images of a tree.
+ * IN:		filename:	the file to write
+ *		topologyTree:	the tree to save
+ * RETURNS:	0 on success, -1 on error (errno is set)
+ */
+int writeSnapshot(const char *filename, TopologyTree *topologyTree);
+
+/*
+ * Map a snapshot file into memory and check it.
+ * RETURNS:	the freshly malloced snapshot, NULL on error
+ */
+Snapshot *openSnapshot(const char *filename);
+
+/*
+ * Build a topology tree from a snapshot. The self-IDs and ROM images are
+ * parsed straight from the mapping, the Rom_info structures point into it.
+ * The tree must therefore be freed before the snapshot is closed.
+ * RETURNS:	the freshly malloced tree, NULL if the self-IDs do not
+ *		describe a valid tree
+ */
+TopologyTree *spawnSnapshotTopologyTree(Snapshot *snapshot);
+
+void closeSnapshot(Snapshot *snapshot);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * speedMap.c - hop count and speed map for all pairs of nodes
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "speedMap.h"
+#include <string.h>
+
+#define MIN(a,b) ((a)<(b)?(a):(b))
+
+static SpeedMap speedMapCache;
+static int speedMapValid = 0;
+
+static int speedMapMatches(TopologyTree *topologyTree)
+{
+	int i;
+
+	if (!speedMapValid) return 0;
+	if (speedMapCache.generation != topologyTree->generation) return 0;
+	if (speedMapCache.nodeCount != topologyTree->nodeCount) return 0;
+	for (i=0; i < topologyTree->nodeCount; i++)
+		if (memcmp(&speedMapCache.selfid[i], topologyTree->selfid[i],
+			sizeof(SelfIdPacket_t))) return 0;
+	return 1;
+}
+
+/*
+ * Walk the tree outwards from one node. Every node is reached from the
+ * neighbour closer to the source, so hop count, speed and bottleneck follow
+ * from that neighbour in O(1).
+ */
+static void speedMapFromNode(SpeedMap *speedMap, TopologyTree *topologyTree,
+	int from)
+{
+	unsigned char queue[MAX_NODES], seen[MAX_NODES];
+	int head = 0, tail = 0, node, next, j, n, sp;
+
+	memset(seen, 0, sizeof(seen));
+	speedMap->hops[from][from] = 0;
+	speedMap->speed[from][from] =
+		topologyTree->selfid[from][0].packetZero.phySpeed;
+	speedMap->bottleneck[from][from] = from;
+	seen[from] = 1;
+	queue[tail++] = from;
+	while (head < tail) {
+		node = queue[head++];
+		n = numberOfChilds(topologyTree, node);
+		for (j=0; j <= n; j++) {
+			/* neighbours: all childs and the parent */
+			if (j < n) next = getNthChild(topologyTree, node, j+1);
+			else next = topologyTree->parent[node];
+			if (next == NO_NODE || seen[next]) continue;
+			seen[next] = 1;
+			queue[tail++] = next;
+			sp = topologyTree->selfid[next][0].packetZero.phySpeed;
+			speedMap->hops[from][next] =
+				speedMap->hops[from][node] + 1;
+			if (sp < speedMap->speed[from][node]) {
+				speedMap->speed[from][next] = sp;
+				speedMap->bottleneck[from][next] = next;
+			} else {
+				speedMap->speed[from][next] =
+					speedMap->speed[from][node];
+				speedMap->bottleneck[from][next] =
+					speedMap->bottleneck[from][node];
+			}
+		}
+	}
+}
+
+SpeedMap *getSpeedMap(TopologyTree *topologyTree)
+{
+	int i;
+
+	if (topologyTree == NULL) return NULL;
+	if (speedMapMatches(topologyTree)) return &speedMapCache;
+
+	DEBUG_GENERAL fprintf(stderr, "Computing speed map for generation %u\n",
+		topologyTree->generation);
+	speedMapCache.generation = topologyTree->generation;
+	speedMapCache.nodeCount = topologyTree->nodeCount;
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		speedMapCache.selfid[i] = topologyTree->selfid[i][0];
+		speedMapFromNode(&speedMapCache, topologyTree, i);
+	}
+	speedMapValid = 1;
+	return &speedMapCache;
+}
+
+int speedMapHops(SpeedMap *speedMap, int from, int to)
+{
+	return speedMap->hops[from][to];
+}
+
+int speedMapSpeed(SpeedMap *speedMap, int from, int to)
+{
+	return speedMap->speed[from][to];
+}
+
+int speedMapBottleneck(SpeedMap *speedMap, int from, int to)
+{
+	return speedMap->bottleneck[from][to];
+}
+
+int speedMapMaxHops(SpeedMap *speedMap)
+{
+	int i, j, max = 0;
+
+	for (i=0; i < speedMap->nodeCount; i++)
+		for (j=0; j < speedMap->nodeCount; j++)
+			if (speedMap->hops[i][j] > max)
+				max = speedMap->hops[i][j];
+	return max;
+}
+
+int speedMapIsBottleneck(SpeedMap *speedMap, int from, int to)
+{
+	int ends = MIN(speedMap->speed[from][from], speedMap->speed[to][to]);
+	return speedMap->speed[from][to] < ends;
+}
+
+void writeSpeedMap(FILE *stream, SpeedMap *speedMap)
+{
+	int i, j, n = speedMap->nodeCount;
+
+	fprintf(stream, "# Speed map, generation %u, %i nodes\n",
+		speedMap->generation, n);
+	fprintf(stream, "# speed/hops from row to column\n");
+	fprintf(stream, "    ");
+	for (j=0; j < n; j++) fprintf(stream, " %7i", j);
+	fprintf(stream, "\n");
+	for (i=0; i < n; i++) {
+		fprintf(stream, "%3i ", i);
+		for (j=0; j < n; j++)
+			fprintf(stream, " %4s/%-2i",
+				decode_speed(speedMap->speed[i][j]),
+				speedMap->hops[i][j]);
+		fprintf(stream, "\n");
+	}
+	fprintf(stream, "# Bottlenecks (path slower than both ends)\n");
+	for (i=0; i < n; i++) {
+		for (j=i+1; j < n; j++) {
+			if (!speedMapIsBottleneck(speedMap, i, j)) continue;
+			fprintf(stream, "%i <-> %i: %s, limited by node %i\n",
+				i, j, decode_speed(speedMap->speed[i][j]),
+				speedMap->bottleneck[i][j]);
+		}
+	}
+}
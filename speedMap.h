@@ -0,0 +1,80 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * speedMap.h - hop count and speed map for all pairs of nodes
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SPEEDMAP_H__
+#define __SPEEDMAP_H__
+#include "topologyTree.h"
+#include <stdio.h>
+
+/*
+ * Hop count, maximum usable speed and the limiting node of the path between
+ * every pair of nodes. The usable speed of a path is the lowest phySpeed of
+ * all PHYs along it, including both ends.
+ */
+typedef struct SpeedMap_t {
+	unsigned int		generation;
+	int			nodeCount;
+	SelfIdPacket_t		selfid[MAX_NODES];	/* cache key */
+	unsigned char		hops[MAX_NODES][MAX_NODES];
+	unsigned char		speed[MAX_NODES][MAX_NODES];
+	unsigned char		bottleneck[MAX_NODES][MAX_NODES];
+} SpeedMap;
+
+/*
+ * Get the speed map of a topology tree. The map is computed with one
+ * traversal per source node and cached until the generation or the
+ * self-IDs change.
+ * RETURNS:	pointer to the cached map, valid until the next call with a
+ *		different tree
+ */
+SpeedMap *getSpeedMap(TopologyTree *topologyTree);
+
+int speedMapHops(SpeedMap *speedMap, int from, int to);
+
+/*
+ * RETURNS:	maximum usable speed from one node to another (0 = S100,
+ *		1 = S200, 2 = S400, see decode_speed)
+ */
+int speedMapSpeed(SpeedMap *speedMap, int from, int to);
+
+/*
+ * RETURNS:	the first node along the path that limits its speed
+ */
+int speedMapBottleneck(SpeedMap *speedMap, int from, int to);
+
+/*
+ * RETURNS:	the maximum hop count between any two nodes (the bus diameter)
+ */
+int speedMapMaxHops(SpeedMap *speedMap);
+
+/*
+ * RETURNS:	non zero if the path between two nodes is slower than both
+ *		of its ends
+ */
+int speedMapIsBottleneck(SpeedMap *speedMap, int from, int to);
+
+/*
+ * Write the speed map and hop count matrix as text.
+ * IN:		stream:		where to write to
+ * 		speedMap:	the map to write
+ */
+void writeSpeedMap(FILE *stream, SpeedMap *speedMap);
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * syntheticBus.c - seeded synthetic topologies and configuration ROMs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "syntheticBus.h"
+
+#define GAP_COUNT 63
+#define ROM_MAGIC 0x31333934
+
+typedef struct {
+	unsigned int	spec_id;
+	unsigned int	sw_version;
+	char		*name;
+} SyntheticUnit;
+
+static const SyntheticUnit units[] = {
+	{ 0x00A02D, 0x010001, "AV/C" },
+	{ 0x00609E, 0x010483, "SBP-2" },
+	{ 0x00A02D, 0x000101, "IIDC" },
+	{ 0x00005E, 0x000001, "IPv4" },
+};
+
+/*
+ * xorshift32, so the same seed gives the same bus with every libc
+ */
+static unsigned int synthRandom(unsigned int *state)
+{
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static int synthRange(unsigned int *state, int n)
+{
+	return synthRandom(state) % n;
+}
+
+/*
+ * CRC-16 of IEEE 1212 over a block of quadlets
+ */
+static quadlet_t synthCrc16(quadlet_t *data, int length)
+{
+	int i, shift;
+	unsigned int crc = 0, sum;
+
+	for (i=0; i < length; i++) {
+		for (shift=28; shift >= 0; shift -= 4) {
+			sum = ((crc >> 12) ^ (data[i] >> shift)) & 0xF;
+			crc = (crc << 4) ^ (sum << 12) ^ (sum << 5) ^ sum;
+		}
+		crc &= 0xFFFF;
+	}
+	return crc;
+}
+
+/*
+ * Write a directory or leaf header in front of length quadlets
+ */
+static void synthBlock(quadlet_t *header, int length)
+{
+	*header = (length << 16) | synthCrc16(header + 1, length);
+}
+
+/*
+ * Build the configuration ROM image of one node.
+ * RETURNS:	length of the image in quadlets
+ */
+static int synthRom(quadlet_t *rom, unsigned int *state, int index, int phyID)
+{
+	const SyntheticUnit *unit;
+	unsigned int vendor;
+	char text[4*8];
+	int i, textQuadlets, cyc_clk_acc;
+
+	unit = &units[synthRange(state, sizeof(units)/sizeof(units[0]))];
+	vendor = 0x020000 | synthRange(state, 0x10000);
+	cyc_clk_acc = synthRange(state, 4) ? synthRange(state, 101) : 0xFF;
+	memset(text, 0, sizeof(text));
+	snprintf(text, sizeof(text), "Synthetic %s %i", unit->name, phyID);
+	textQuadlets = (strlen(text) + 4) / 4;
+
+	/* Bus info block */
+	rom[1] = ROM_MAGIC;
+	rom[2] = ((quadlet_t) synthRange(state, 2) << 31) | (synthRange(state, 2) << 30)
+		| (synthRange(state, 2) << 29) | (synthRange(state, 2) << 28)
+		| (cyc_clk_acc << 16) | ((8 + synthRange(state, 3)) << 12);
+	rom[3] = (vendor << 8) | synthRange(state, 0x100);
+	rom[4] = (synthRandom(state) & 0xFFFFFF00) | index;
+	rom[0] = (4 << 24) | (4 << 16) | synthCrc16(rom + 1, 4);
+
+	/* Root directory, offsets are relative to the entry */
+	rom[6] = (0x03 << 24) | vendor;
+	rom[7] = ((quadlet_t) 0x81 << 24) | (14 - 7);
+	rom[8] = (0x0C << 24) | 0x0083C0;
+	rom[9] = ((quadlet_t) 0xD1 << 24) | (10 - 9);
+	synthBlock(&rom[5], 4);
+
+	/* Unit directory */
+	rom[11] = (0x12 << 24) | unit->spec_id;
+	rom[12] = (0x13 << 24) | unit->sw_version;
+	rom[13] = (0x17 << 24) | synthRange(state, 0x1000000);
+	synthBlock(&rom[10], 3);
+
+	/* Textual leaf */
+	rom[15] = 0;
+	rom[16] = 0;
+	for (i=0; i < textQuadlets; i++) {
+		rom[17+i] = (text[4*i] << 24) | (text[4*i+1] << 16)
+			| (text[4*i+2] << 8) | text[4*i+3];
+	}
+	synthBlock(&rom[14], 2 + textQuadlets);
+	return 17 + textQuadlets;
+}
+
+/*
+ * Number the nodes of the generated tree in post-order, which is the order
+ * of the self-IDs. Childs are visited in port order.
+ */
+static int synthNumber(int node, const unsigned char *parent, int nnodes,
+	unsigned char *phyID, int next)
+{
+	int k;
+
+	for (k=node+1; k < nnodes; k++)
+		if (parent[k] == node)
+			next = synthNumber(k, parent, nnodes, phyID, next);
+	phyID[node] = next;
+	return next + 1;
+}
+
+/*
+ * Append the self-ID packets of one node to the map.
+ * RETURNS:	number of packets
+ */
+static int synthSelfIds(quadlet_t *q, unsigned int *state, int phyID,
+	int linkActive, const unsigned char *ports, int nports)
+{
+	int npackets, n, i, port;
+
+	npackets = nports <= 3 ? 1 : 1 + (nports - 3 + 7) / 8;
+	q[0] = TEST_SELFID | (phyID << 24) | (linkActive << 22)
+		| (GAP_COUNT << 16) | (synthRange(state, 4) << 14)
+		| (synthRange(state, 2) << 11) | (synthRange(state, 8) << 8)
+		| (ports[0] << 6) | (ports[1] << 4) | (ports[2] << 2)
+		| (npackets > 1);
+	for (n=1; n < npackets; n++) {
+		q[n] = TEST_SELFID | (phyID << 24) | (1 << 23)
+			| ((n-1) << 20) | (npackets > n+1);
+		for (i=0; i < 8; i++) {
+			port = 3 + (n-1)*8 + i;
+			q[n] |= ports[port] << (16 - 2*i);
+		}
+	}
+	return npackets;
+}
+
+SyntheticBus *generateSyntheticBus(unsigned int seed, int nnodes, int shape,
+	int maxPorts)
+{
+	SyntheticBus *bus;
+	unsigned int state;
+	unsigned char parent[MAX_NODES], degree[MAX_NODES], phyID[MAX_NODES];
+	unsigned char ports[MAX_NODES][SYNTH_MAX_PORTS];
+	unsigned char slots[SYNTH_MAX_PORTS], tmp;
+	int i, k, p, n, hub, nports, nslots, selfIdCount, node[MAX_NODES];
+
+	if (nnodes < 1 || nnodes >= MAX_NODES) return NULL;
+	if (maxPorts < 1 || maxPorts > SYNTH_MAX_PORTS) return NULL;
+	state = seed ? seed : 0x1394;
+
+	/* Shape: node 0 is the root, every other node has a lower parent */
+	parent[0] = NO_NODE;
+	hub = maxPorts < nnodes-1 ? maxPorts : nnodes-1;
+	for (k=1, p=0, n=0; k < nnodes; k++) {
+		switch (shape) {
+			case SYNTH_SHAPE_CHAIN:
+				parent[k] = k-1;
+				break;
+			case SYNTH_SHAPE_STAR:
+				parent[k] = k <= hub ? 0 : k - hub;
+				break;
+			case SYNTH_SHAPE_BALANCED:
+				if (n == (p ? maxPorts-1 : maxPorts)) {
+					p++;
+					n = 0;
+				}
+				parent[k] = p;
+				n++;
+				break;
+			default:
+				return NULL;
+		}
+	}
+	memset(degree, 0, sizeof(degree));
+	for (k=1; k < nnodes; k++) {
+		degree[k]++;
+		degree[parent[k]]++;
+	}
+	for (k=0; k < nnodes; k++)
+		if (degree[k] > maxPorts) return NULL;
+
+	bus = malloc(sizeof(SyntheticBus));
+	if (!bus) fatal("out of memory!");
+	memset(bus->romLength, 0, sizeof(bus->romLength));
+
+	/*
+	 * Ports: pick the port count and the ports used for the connections
+	 * at random. The childs take the used ports in ascending order, the
+	 * parent any one of them.
+	 */
+	for (k=0; k < nnodes; k++) {
+		nports = degree[k] + synthRange(&state, maxPorts - degree[k] + 1);
+		if (nports == 0) nports = 1;
+		memset(ports[k], SELFID_PORT_NONE, SYNTH_MAX_PORTS);
+		for (i=0; i < nports; i++) {
+			ports[k][i] = SELFID_PORT_NCONN;
+			slots[i] = i;
+		}
+		for (i=0; i < degree[k]; i++) {
+			n = i + synthRange(&state, nports - i);
+			tmp = slots[i]; slots[i] = slots[n]; slots[n] = tmp;
+		}
+		nslots = degree[k];
+		for (i=1; i < nslots; i++)	/* sort the chosen slots */
+			for (n=i; n > 0 && slots[n-1] > slots[n]; n--) {
+				tmp = slots[n]; slots[n] = slots[n-1];
+				slots[n-1] = tmp;
+			}
+		if (parent[k] != NO_NODE) {
+			n = synthRange(&state, nslots);
+			ports[k][slots[n]] = SELFID_PORT_PARENT;
+		}
+		for (i=0; i < nslots; i++)
+			if (ports[k][slots[i]] == SELFID_PORT_NCONN)
+				ports[k][slots[i]] = SELFID_PORT_CHILD;
+	}
+
+	/*
+	 * The childs have to be visited in port order, which is ascending
+	 * construction order since the child ports are assigned that way.
+	 */
+	synthNumber(0, parent, nnodes, phyID, 0);
+	for (k=0; k < nnodes; k++) node[phyID[k]] = k;
+
+	selfIdCount = 0;
+	for (i=0; i < nnodes; i++) {
+		k = node[i];
+		for (nports=SYNTH_MAX_PORTS; nports > 0; nports--)
+			if (ports[k][nports-1] != SELFID_PORT_NONE) break;
+		n = synthRange(&state, 8) != 0;	/* link layer active */
+		selfIdCount += synthSelfIds((quadlet_t *)
+			&bus->map.selfIdPacket[selfIdCount], &state, i, n,
+			ports[k], nports);
+		if (n) bus->romLength[i] = synthRom(bus->rom[i], &state, k, i);
+	}
+	bus->map.length = selfIdCount + 2;
+	bus->map.crc = 0;	/* invalid */
+	bus->map.generationNumber = seed;
+	bus->map.nodeCount = nnodes;
+	bus->map.selfIdCount = selfIdCount;
+	return bus;
+}
+
+TopologyTree *spawnSyntheticTopologyTree(SyntheticBus *bus)
+{
+	int i;
+	TopologyTree *topologyTree;
+
+	topologyTree = spawnTopologyTreeShape(&bus->map);
+	if (topologyTree == NULL) return NULL;
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		if (bus->romLength[i] > 0) {
+			parse_rom_image(bus->rom[i], bus->romLength[i],
+				&topologyTree->rom_info[i]);
+		}
+	}
+	return topologyTree;
+}
+
+RAW1394topologyMap *generateTestTopologyMap(unsigned int seed, int nnodes) {
+	RAW1394topologyMap *map;
+	SyntheticBus *bus;
+
+	bus = generateSyntheticBus(seed, nnodes, SYNTH_SHAPE_BALANCED, 3);
+	if (bus == NULL) return NULL;
+	map = malloc(sizeof(RAW1394topologyMap));
+	if (!map) fatal("out of memory!");
+	memcpy(map, &bus->map, sizeof(RAW1394topologyMap));
+	free(bus);
+	return map;
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * syntheticBus.h - seeded synthetic topologies and configuration ROMs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SYNTHETICBUS_H__
+#define __SYNTHETICBUS_H__
+#include "topologyTree.h"
+
+#define TEST_SELFID 0x80000000
+
+#define SYNTH_SHAPE_CHAIN	0	/* daisy chain */
+#define SYNTH_SHAPE_STAR	1	/* hub with chains hanging off its ports */
+#define SYNTH_SHAPE_BALANCED	2	/* every node fans out as far as it can */
+
+#define SYNTH_MAX_PORTS		MAX_CHILDS
+#define SYNTH_ROM_QUADLETS	64
+
+/*
+ * A generated bus: the topology map as it would be read from the CSR space
+ * and an image of the configuration ROM of every node with an active link
+ * layer, indexed by phyID. The ROM images are in host byte order.
+ */
+typedef struct SyntheticBus_t {
+	RAW1394topologyMap	map;
+	quadlet_t		rom[MAX_NODES][SYNTH_ROM_QUADLETS];
+	int			romLength[MAX_NODES];	/* 0 = no link layer */
+} SyntheticBus;
+
+/*
+ * Generate a bus. The same arguments always give the same bus.
+ * IN:		seed:		seed for the random choices
+ *		nnodes:		number of nodes, 1 to 63
+ *		shape:		one of the SYNTH_SHAPE_ constants
+ *		maxPorts:	largest PHY port count, 1 to 27. Port counts,
+ *				speeds, power classes and the ports used for
+ *				each connection are picked at random.
+ * RETURNS:	the freshly malloced bus, NULL if the shape does not fit
+ *		into nnodes and maxPorts
+ */
+SyntheticBus *generateSyntheticBus(unsigned int seed, int nnodes, int shape,
+	int maxPorts);
+
+/*
+ * Build a topology tree from a generated bus, parsing the ROM images
+ * instead of reading the configuration ROMs from the bus.
+ */
+TopologyTree *spawnSyntheticTopologyTree(SyntheticBus *bus);
+
+/*
+ * Generate a balanced topology map of 3 port nodes.
+ * IN:		seed:	seed for the random choices, as for
+ *			generateSyntheticBus
+ *		nnodes:	number of nodes, 1 to 63
+ * RETURNS:	pointer to a freshly malloced map, NULL if nnodes is out
+ *		of range
+ */
+RAW1394topologyMap *generateTestTopologyMap(unsigned int seed, int nnodes);
+
+#endif
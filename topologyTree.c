@@ -24,7 +24,6 @@
 #include <netinet/in.h>
 #include "topologyTree.h"
 
-#define MIN(x,y) ((x)<(y))?(x):(y)
 #define MAX(a,b) ((a)>(b)?(a):(b))
 
 static const char *decodeCameraSwVersion(quadlet_t quadlet) 
@@ -34,251 +33,247 @@ static const char *decodeCameraSwVersion(quadlet_t quadlet)
 	return "Unknown";
 }
 
-static int flipcoin(void) 
+/*
+ * Link the nodes of the tree. The self-IDs arrive in post-order, so the
+ * childs of a node are the subtrees completed most recently before it.
+ * The roots of completed subtrees are kept on an explicit stack, each node
+ * pops one entry per child port and pushes itself. Childs with lower
+ * phyIDs are connected to lower ports, so the popped entries can be
+ * appended to the CSR edge list in stack order.
+ * RETURNS:	0 on success, -1 if the child counts do not match the nodes
+ */
+static int linkTopologyTree(TopologyTree *topologyTree)
 {
-	return (random()/(RAND_MAX/2));
-}
+	unsigned char stack[MAX_NODES];
+	unsigned char ports[MAX_CHILDS];
+	int sp = 0, pos = 0, i, j, port, nchilds, child;
 
-RAW1394topologyMap *generateTestTopologyMap(int nnodes) {
-	RAW1394topologyMap *map;
-	quadlet_t *pselfid;
-	int i, leafes;
-	map = malloc(sizeof(RAW1394topologyMap));
-	if (!map) fatal("out of memory!");
-	leafes = 1;
-	for (i=nnodes-1; i>=0; i--) {
-		pselfid = ((quadlet_t *) &(map->selfIdPacket[i]));
-		*pselfid = (TEST_SELFID | (i<<24));
-		if (i<nnodes-1) *pselfid = *pselfid | (2<<6);	/*has parent*/
-		if (i<=leafes) { /*no childs*/
-		} else {	 /*has childs*/
-			*pselfid = *pselfid | (3<<4);
-			if (flipcoin()) {
-				*pselfid = *pselfid | (3<<2);
-				leafes++;
-			}
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		nchilds = 0;
+		for (port=0; port < MAX_CHILDS; port++) {
+			if (selfid_port_status(topologyTree->selfid[i], port)
+				== SELFID_PORT_CHILD) ports[nchilds++] = port;
+		}
+		if (nchilds > sp) {
+			DEBUG_GENERAL fprintf(stderr, "node %i claims %i childs, "
+				"only %i unlinked nodes left\n", i, nchilds, sp);
+			return -1;
 		}
-		/*printf("Node: %i: %08x\n",i,*pselfid);*/
+		sp -= nchilds;
+		topologyTree->parent[i] = NO_NODE;
+		topologyTree->firstChild[i] = pos;
+		topologyTree->nchilds[i] = nchilds;
+		for (j=0; j < nchilds; j++) {
+			child = stack[sp+j];
+			topologyTree->parent[child] = i;
+			topologyTree->child[pos] = child;
+			topologyTree->childPort[pos] = ports[j];
+			pos++;
+		}
+		stack[sp++] = i;
+	}
+	if (sp != 1) {
+		DEBUG_GENERAL fprintf(stderr, "%i unlinked subtrees left\n", sp);
+		return -1;
 	}
-	map->length = nnodes*4+4;
-	map->crc = 0;	/*invalid*/
-	map->generationNumber = 0;
-	map->nodeCount = nnodes;
-	map->selfIdCount = nnodes;
-	return map;
+	return 0;
 }
 
 /*
- * in:	topologyTree: topology Tree from lowest node on
- * 	nodeid: number of root node of current subtree
- *	parent: parent node of subtree
- * out:	number of next lower unprocessed child node
+ * Compute the per node metrics. Ascending phyIDs are a post-order walk, so
+ * the subtree aggregates are complete when a node is reached. The level
+ * is then filled in top-down by a descending scan from the root.
  */
-int spawnTopologySubTree(TopologyTree *topologyTree, int nodeid,
-			TopologyTree *parent) 
+static void computeTopologyTreeMetrics(TopologyTree *topologyTree)
 {
-	SelfIdPacket_t *selfid0, *selfid1, *selfid2, *selfid3;
-	TopologyTree *pnode;
-	int myid;
-	/* FIXME - only handles three ports */
-	/*printf("SpawnTopologySubTree called with nodeid: %d\n",nodeid);*/
-	myid = nodeid;			/* remember current id */
-	pnode = &topologyTree[nodeid];	/* point at current node */
-	selfid0 = pnode->selfid;		/* get current node selfid */
-	pnode->parent = parent;		/* set parent node */
-	nodeid--;			/* process only lower nodes */
-	/* get nodeids of child nodes */
-	if (selfid0->packetZero.morePackets == 1) {
-		selfid1 = selfid0+1;
-		if (selfid1->packetMore.morePackets == 1) {
-			selfid2 = selfid1+1;
-			if (selfid2->packetMore.morePackets == 1) {
-				selfid3 = selfid2+1;
-				/* FIXME */
-			}
-			/* FIXME */
-		}
-		if (selfid1->packetMore.portH == SELFID_PORT_CHILD)  {
-			pnode->child[10] = &topologyTree[nodeid];
-			nodeid = spawnTopologySubTree(topologyTree, nodeid,
-				pnode);
-		}
-		if (selfid1->packetMore.portG == SELFID_PORT_CHILD)  {
-			pnode->child[9] = &topologyTree[nodeid];
-			nodeid = spawnTopologySubTree(topologyTree, nodeid,
-				pnode);
-		}
-		if (selfid1->packetMore.portF == SELFID_PORT_CHILD)  {
-			pnode->child[8] = &topologyTree[nodeid];
-			nodeid = spawnTopologySubTree(topologyTree, nodeid,
-				pnode);
-		}
-		if (selfid1->packetMore.portE == SELFID_PORT_CHILD)  {
-			pnode->child[7] = &topologyTree[nodeid];
-			nodeid = spawnTopologySubTree(topologyTree, nodeid,
-				pnode);
-		}
-		if (selfid1->packetMore.portD == SELFID_PORT_CHILD)  {
-			pnode->child[6] = &topologyTree[nodeid];
-			nodeid = spawnTopologySubTree(topologyTree, nodeid,
-				pnode);
-		}
-		if (selfid1->packetMore.portC == SELFID_PORT_CHILD)  {
-			pnode->child[5] = &topologyTree[nodeid];
-			nodeid = spawnTopologySubTree(topologyTree, nodeid,
-				pnode);
-		}
-		if (selfid1->packetMore.portB == SELFID_PORT_CHILD)  {
-			pnode->child[4] = &topologyTree[nodeid];
-			nodeid = spawnTopologySubTree(topologyTree, nodeid,
-				pnode);
-		}
-		if (selfid1->packetMore.portA == SELFID_PORT_CHILD)  {
-			pnode->child[3] = &topologyTree[nodeid];
-			nodeid = spawnTopologySubTree(topologyTree, nodeid,
-				pnode);
+	int i, j, c, first, nchilds;
+
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		first = topologyTree->firstChild[i];
+		nchilds = topologyTree->nchilds[i];
+		topologyTree->height[i] = 1;
+		topologyTree->size[i] = 1;
+		topologyTree->leafes[i] = (nchilds == 0);
+		topologyTree->childIndex[i] = 0;
+		for (j=0; j < nchilds; j++) {
+			c = topologyTree->child[first+j];
+			topologyTree->height[i] = MAX(topologyTree->height[i],
+				topologyTree->height[c] + 1);
+			topologyTree->size[i] += topologyTree->size[c];
+			topologyTree->leafes[i] += topologyTree->leafes[c];
+			topologyTree->childIndex[c] = j+1;
 		}
 	}
-	if (selfid0->packetZero.port2 == SELFID_PORT_CHILD)  {
-		/*printf("Child3 of node %d is node %d\n", myid, nodeid);*/
-		pnode->child[2] = &topologyTree[nodeid];
-		nodeid = spawnTopologySubTree(topologyTree, nodeid, pnode);
-	}
-	if (selfid0->packetZero.port1 == SELFID_PORT_CHILD)  {
-		/*printf("Child2 of node %d is node %d\n", myid, nodeid);*/
-		pnode->child[1] = &topologyTree[nodeid];
-		nodeid = spawnTopologySubTree(topologyTree, nodeid, pnode);
-	}
-	if (selfid0->packetZero.port0 == SELFID_PORT_CHILD)  {
-		/*printf("Child1 of node %d is node %d\n", myid, nodeid);*/
-		pnode->child[0] = &topologyTree[nodeid];
-		nodeid = spawnTopologySubTree(topologyTree, nodeid, pnode);
+	for (i=topologyTree->nodeCount-1; i >= 0; i--) {
+		if (topologyTree->parent[i] == NO_NODE)
+			topologyTree->level[i] = 0;
+		else
+			topologyTree->level[i] =
+				topologyTree->level[topologyTree->parent[i]] + 1;
 	}
-	return nodeid;
 }
 
-TopologyTree *spawnTopologyTree(raw1394handle_t handle,
-				RAW1394topologyMap *topologyMap) 
+TopologyTree *spawnTopologyTreeShape(RAW1394topologyMap *topologyMap)
 {
-	int i, j, ret, selfIdCount, nodeCount;
+	int i, n, ret, selfIdCount, nodeCount;
 	unsigned int *pselfid_int;
-	//unsigned char *pselfid_char;
-	TopologyTree *topologyTree, *ptopologyTree;
+	TopologyTree *topologyTree;
 
 	if (topologyMap == NULL) return NULL;
 	selfIdCount = topologyMap->selfIdCount;
 	nodeCount = topologyMap->nodeCount;
-	//topologyTree = calloc(nodeCount, sizeof(TopologyTree));
-	topologyTree = malloc(nodeCount*sizeof(TopologyTree));
+	if (nodeCount < 1 || nodeCount >= MAX_NODES) return NULL;
+	topologyTree = malloc(sizeof(TopologyTree));
 	if (!topologyTree) fatal("out of memory!");
-	ptopologyTree = topologyTree;
-	for (i=0; i < selfIdCount; i++) {
-		//pselfid_int = (void *) &topologyMap->selfIdPacket[i];
-		//ret = decode_selfid(&(ptopologyTree->selfid), *pselfid_int);
+	topologyTree->nodeCount = nodeCount;
+	topologyTree->root = nodeCount-1;
+	topologyTree->generation = topologyMap->generationNumber;
+	topologyTree->timestamp = time(NULL);
+	topologyTree->mapCrc = topologyMap->crc;
+	topologyTree->scan = 0;
+	topologyTree->romsPending = 0;
+	memset(topologyTree->romPending, 0, sizeof(topologyTree->romPending));
+	topologyTree->labelPoolUsed = 0;
+	topologyTreeInternLabel(topologyTree, "Unknown");	/* offset 0 */
+	n = 0;
+	for (i=0; i < selfIdCount && n < nodeCount; i++) {
 		pselfid_int = (unsigned int *) &topologyMap->selfIdPacket[i];
-		ret = decode_selfid(ptopologyTree->selfid, pselfid_int);
+		memset(topologyTree->selfid[n], 0,
+			sizeof(topologyTree->selfid[n]));
+		ret = decode_selfid(topologyTree->selfid[n], pselfid_int);
 		if (ret < 0) {
-			//printbin(*((unsigned int *)ptopologyTree->selfid),32);
-			//printbin(*((unsigned int *)ptopologyTree->selfid),32);
-			//printbin(*((unsigned int *)ptopologyTree->selfid),32);
-			//printbin(*((unsigned int *)ptopologyTree->selfid),32);
 			fatal("invalid or unsupported selfid format!");
 		}
-		if (ptopologyTree->selfid[0].packetZero.linkActive) {
-			get_rom_info(handle,
-				ptopologyTree->selfid[0].packetZero.phyID,
-				&ptopologyTree->rom_info);
-		} else {
-			init_rom_info(&ptopologyTree->rom_info);
-		}
-		ptopologyTree->parent = NULL;
-		for (j=0; j < MAX_CHILDS; j++) 
-			ptopologyTree->child[j] = NULL;
-		ptopologyTree++;
+		memset(topologyTree->rawSelfId[n], 0,
+			sizeof(topologyTree->rawSelfId[n]));
+		memcpy(topologyTree->rawSelfId[n], pselfid_int,
+			ret * sizeof(quadlet_t));
+		init_rom_info(&topologyTree->rom_info[n]);
+		topologyTree->label[n] = 0;
+		n++;
 		DEBUG_GENERAL fprintf(stderr, "selfIdCount: %i, nodeCount: %i, i: %i, selfids: %i\n",
 			selfIdCount, nodeCount, i, ret);
 		i += (ret-1);
 	};
-	spawnTopologySubTree(topologyTree, nodeCount-1, NULL);
-	return &topologyTree[nodeCount-1];	/* return root node */
+	topologyTree->nodeCount = n;
+	topologyTree->root = n-1;
+	if (linkTopologyTree(topologyTree) < 0) {
+		fprintf(stderr, "self-IDs do not describe a valid tree\n");
+		freeTopologyTree(topologyTree);
+		return NULL;
+	}
+	computeTopologyTreeMetrics(topologyTree);
+	return topologyTree;
 }
 
-TopologyTree *topologyTreeLowestNode(TopologyTree *topologyTree) 
+int readTopologyTreeRoms(raw1394handle_t handle,
+	TopologyTree *topologyTree, RomProgress progress, void *data)
 {
-	TopologyTree *p = topologyTree;
 	int i;
-	for (i=0; i<MAX_CHILDS; i++) {
-		if (p->child[i] != NULL) p = MIN(topologyTreeLowestNode(
-			p->child[i]), p);
+
+	for (i=0; i < topologyTree->nodeCount; i++) {
+		if (topologyTree->selfid[i][0].packetZero.linkActive) {
+			get_rom_info(handle,
+				topologyTree->selfid[i][0].packetZero.phyID,
+				&topologyTree->rom_info[i]);
+			if (progress != NULL
+				&& progress(topologyTree, i, data) != 0)
+				return -1;
+		}
 	}
-	return p;
+	return 0;
 }
 
-void freeSubTopologyTree(TopologyTree *topologyTree) 
+void freeTopologyTree(TopologyTree *topologyTree) 
 {
 	int i;
-	for (i=0; i<MAX_CHILDS; i++) {
-		if (topologyTree->child[i] != NULL)
-			freeSubTopologyTree(topologyTree->child[i]);
+	for (i=0; i < topologyTree->nodeCount; i++)
+		free_rom_info(&topologyTree->rom_info[i]);
+	free(topologyTree);
+}
+
+int topologyTreeInternLabel(TopologyTree *topologyTree, const char *label)
+{
+	int offset = 0, len;
+
+	if (label == NULL) return 0;
+	while (offset < topologyTree->labelPoolUsed) {
+		if (strcmp(topologyTree->labelPool + offset, label) == 0)
+			return offset;
+		offset += strlen(topologyTree->labelPool + offset) + 1;
 	}
-	free_rom_info(&topologyTree->rom_info);
+	len = strlen(label) + 1;
+	if (offset + len > LABEL_POOL_SIZE) return 0;	/* pool exhausted */
+	memcpy(topologyTree->labelPool + offset, label, len);
+	topologyTree->labelPoolUsed += len;
+	return offset;
 }
 
-void freeTopologyTree(TopologyTree *topologyTree) 
+void setNodeLabel(TopologyTree *topologyTree, int node, const char *label)
 {
-	TopologyTree *ptopologyTree = topologyTreeLowestNode(topologyTree);
-	freeSubTopologyTree(topologyTree);
-	return;	//FIXME
-	free(ptopologyTree);
+	topologyTree->label[node] = topologyTreeInternLabel(topologyTree,
+		label);
 }
 
-TopologyTree *topologyTreeRoot(TopologyTree *topologyTree) 
+const char *getNodeLabel(TopologyTree *topologyTree, int node)
 {
-	if (topologyTree->parent == NULL) return topologyTree;
-	else return topologyTreeRoot(topologyTree->parent);
+	return topologyTree->labelPool + topologyTree->label[node];
 }
 
-int topologySubTreeDepth(TopologyTree *node, int level) 
+int topologyTreeRoot(TopologyTree *topologyTree) 
 {
-	int maxdepth, i;
-	if (node == NULL) return level;
-	maxdepth = 0;
-	level++;
-	for (i=0; i<MAX_CHILDS; i++) {
-		maxdepth = MAX(maxdepth, topologySubTreeDepth(node->child[i],
-			level));
-	}
-	return maxdepth;
+	return topologyTree->root;
+}
+
+/*
+ * The subtree of a node consists of the size-1 phyIDs directly below it.
+ */
+int topologyTreeLowestNode(TopologyTree *topologyTree, int node)
+{
+	return node - topologyTree->size[node] + 1;
+}
+
+int topologySubTreeDepth(TopologyTree *topologyTree, int node) 
+{
+	if (node < 0 || node >= topologyTree->nodeCount) return 0;
+	return topologyTree->height[node];
 }
 
 int topologyTreeDepth(TopologyTree *topologyTree) 
 {
-	return topologySubTreeDepth(topologyTreeRoot(topologyTree), 0);
+	return topologyTree->height[topologyTree->root];
 }
 
-int numberOfChilds(TopologyTree *node) 
+int topologySubTreeSize(TopologyTree *topologyTree, int node)
 {
-	int i, n = 0;
+	return topologyTree->size[node];
+}
 
-	if(!node)
-		return 0;
+int topologySubTreeLeafes(TopologyTree *topologyTree, int node)
+{
+	return topologyTree->leafes[node];
+}
 
-	for (i=0; i<MAX_CHILDS; i++) 
-		if (node->child[i] != NULL) 
-			n++;
+int topologyNodeLevel(TopologyTree *topologyTree, int node)
+{
+	return topologyTree->level[node];
+}
 
-	return n;
+int topologyChildIndex(TopologyTree *topologyTree, int node)
+{
+	return topologyTree->childIndex[node];
 }
 
-TopologyTree *getNthChild(TopologyTree *node, int n) 
+int numberOfChilds(TopologyTree *topologyTree, int node) 
 {
-	int i;
-	if (n < 1 || n > MAX_CHILDS) return NULL;
-	for (i=0; i<MAX_CHILDS; i++) {
-		if (node->child[i] != NULL) n--;
-		if (n < 1) return node->child[i];
-	}
-	fatal("Unexpected Error in getNthChild");
-	return NULL;
+	if (!topologyTree || node < 0)
+		return 0;
+
+	return topologyTree->nchilds[node];
 }
 
+int getNthChild(TopologyTree *topologyTree, int node, int n) 
+{
+	if (n < 1 || n > topologyTree->nchilds[node]) return -1;
+	return topologyTree->child[topologyTree->firstChild[node] + n-1];
+}
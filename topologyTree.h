@@ -32,49 +32,115 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
+#include <time.h>
 #include <libraw1394/raw1394.h>
 
-#define TEST_SELFID 0x80000000
-
 #define MAX_CHILDS (3+3*8)
+#define MAX_NODES 64		/* phyID 63 is the broadcast address */
+#define NO_NODE 0xFF
+#define LABEL_POOL_SIZE 4096
 
+/*
+ * The topology tree is kept as a flat structure of arrays indexed by phyID.
+ * Since the self-ID packets arrive in post-order, every node has a higher
+ * phyID than all nodes of its subtree and the root is always the node with
+ * the highest phyID. The children of node n are stored contiguously in
+ * child[firstChild[n]] .. child[firstChild[n]+nchilds[n]-1] in ascending
+ * port order (CSR edge list), childPort holds the port of the parent each
+ * edge is connected to. Labels are interned into labelPool, label[n]
+ * is the offset of the label of node n.
+ * The per node metrics (level, height, subtree size, leaf count and child
+ * index) are computed once when the tree is built. The raw self-ID quadlets
+ * and the CRC of the topology map are kept for saving snapshots.
+ */
 typedef struct TopologyTree_t {
-	SelfIdPacket_t			selfid[4];
-	Rom_info			rom_info;
-	char				label[256];
-	struct TopologyTree_t		*parent;
-	struct TopologyTree_t		*child[MAX_CHILDS];
+	int				nodeCount;
+	int				root;
+	unsigned int			generation;
+	time_t				timestamp;	/* of the scan */
+	unsigned short			mapCrc;
+	unsigned int			scan;
+	int				romsPending;
+	unsigned char			romPending[MAX_NODES];
+	unsigned char			parent[MAX_NODES];
+	unsigned char			nchilds[MAX_NODES];
+	unsigned char			firstChild[MAX_NODES];
+	unsigned char			child[MAX_NODES];
+	unsigned char			childPort[MAX_NODES];
+	unsigned short			label[MAX_NODES];
+	unsigned char			level[MAX_NODES];	/* root = 0 */
+	unsigned char			height[MAX_NODES];	/* leaf = 1 */
+	unsigned char			size[MAX_NODES];
+	unsigned char			leafes[MAX_NODES];
+	unsigned char			childIndex[MAX_NODES];
+	SelfIdPacket_t			selfid[MAX_NODES][4];
+	quadlet_t			rawSelfId[MAX_NODES][4];
+	Rom_info			rom_info[MAX_NODES];
+	int				labelPoolUsed;
+	char				labelPool[LABEL_POOL_SIZE];
 } TopologyTree;
 
-RAW1394topologyMap *generateTestTopologyMap(int nnodes);
+/*
+ * Called by readTopologyTreeRoms after the ROM of a node has been read.
+ * RETURNS:	non-zero to stop reading
+ */
+typedef int (*RomProgress)(TopologyTree *topologyTree, int node, void *data);
 
 /*
- * in:	topologyTree: topology Tree from lowest node on
- * 	nodeid: number of root node of current subtree
- *	parent: parent node of subtree
- * out:	number of next lower unprocessed child node
+ * Read the configuration ROMs of all nodes with an active link layer into
+ * a tree built by spawnTopologyTreeShape.
+ * IN:		progress:	called after each ROM, may be NULL
+ *		data:		passed to progress
+ * RETURNS:	0 if all ROMs were read, -1 if progress stopped the reading
  */
-int spawnTopologySubTree(TopologyTree *topologyTree, int nodeid,
-	TopologyTree *parent);
+int readTopologyTreeRoms(raw1394handle_t handle,
+	TopologyTree *topologyTree, RomProgress progress, void *data);
 
-TopologyTree *spawnTopologyTree(raw1394handle_t handle,
-	RAW1394topologyMap *topologyMap);
+/*
+ * Decode the self-IDs of a topology map into a topology tree without
+ * touching the bus. The Rom_info structures are left empty.
+ * RETURNS:	the freshly malloced tree, or NULL if the self-IDs do not
+ *		describe a valid tree
+ */
+TopologyTree *spawnTopologyTreeShape(RAW1394topologyMap *topologyMap);
 
 void freeTopologyTree(TopologyTree *topologyTree);
 
-TopologyTree *topologyTreeRoot(TopologyTree *topologyTree);
+/*
+ * Intern a label string into the label pool of the tree.
+ * RETURNS:	offset of the string in the label pool
+ */
+int topologyTreeInternLabel(TopologyTree *topologyTree, const char *label);
 
-int topologySubTreeDepth(TopologyTree *node, int level);
+/*
+ * Set / get the label of a node
+ */
+void setNodeLabel(TopologyTree *topologyTree, int node, const char *label);
+
+const char *getNodeLabel(TopologyTree *topologyTree, int node);
+
+int topologyTreeRoot(TopologyTree *topologyTree);
+
+int topologyTreeLowestNode(TopologyTree *topologyTree, int node);
+
+int topologySubTreeDepth(TopologyTree *topologyTree, int node);
 
 int topologyTreeDepth(TopologyTree *topologyTree);
 
-int numberOfChilds(TopologyTree *node);
+int topologySubTreeSize(TopologyTree *topologyTree, int node);
 
-TopologyTree *getNthChild(TopologyTree *node, int n);
+int topologySubTreeLeafes(TopologyTree *topologyTree, int node);
+
+int topologyNodeLevel(TopologyTree *topologyTree, int node);
+
+/*
+ * RETURNS:	position of node among the childs of its parent, counting
+ *		from 1 like getNthChild, 0 for the root node
+ */
+int topologyChildIndex(TopologyTree *topologyTree, int node);
 
-void generateTopologySubTreeString(char *topologyTreeString,
-	TopologyTree *node, int left, int width, int level, int localid);
+int numberOfChilds(TopologyTree *topologyTree, int node);
 
-char *generateTopologyTreeString(TopologyTree *topologyTree, int localid);
+int getNthChild(TopologyTree *topologyTree, int node, int n);
 
 #endif
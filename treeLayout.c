@@ -0,0 +1,495 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * treeLayout.c - cached geometry of the topology drawing
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "treeLayout.h"
+#include "icons.h"
+#include <string.h>
+
+static TreeLayout layout;
+static int layoutValid = 0;
+
+/*
+ * Choose icon and label of a node and set the label in the tree.
+ */
+static void chooseNode(TreeLayout *layout, LayoutNode *ln)
+{
+	TopologyTree *tree = layout->tree;
+	Rom_info *rom_info = &tree->rom_info[ln->node];
+	char *label = NULL;
+
+	chooseIcon(rom_info, &ln->icon, &label);
+	if (tree->romPending[ln->node]) {
+		/* Placeholder until the ROM arrives */
+		setNodeLabel(tree, ln->node, "Reading ROM...");
+	/* Use rom_info->label if it contains something meaningful */
+	} else if (rom_info->label != NULL && strcmp(rom_info->label, "Unknown")) {
+		setNodeLabel(tree, ln->node, rom_info->label);
+	/* Use calculated label otherwise, if it exists */
+	} else if (label != NULL) {
+		setNodeLabel(tree, ln->node, label);
+	} else {
+		setNodeLabel(tree, ln->node, "Unknown");
+	}
+
+	/* Highlight Host controller and give it a Linux pixmap */
+	ln->highlight = tree->selfid[ln->node][0].packetZero.phyID
+		== layout->myPhyID;
+	if (ln->highlight) {
+		if (strcmp(getNodeLabel(tree, ln->node), "Unknown") == 0)
+			setNodeLabel(tree, ln->node, "Localhost");
+		ln->icon = xpm_cpu_linux;
+	}
+	ln->label = getNodeLabel(tree, ln->node);
+	ln->speed = decode_speed(tree->selfid[ln->node][0].packetZero.phySpeed);
+	layout->textWidth = MAX(layout->textWidth,
+		MAX(measureText(ln->speed, FONTHEIGHT),
+		measureText(ln->label, FONTHEIGHT)));
+}
+
+/*
+ * The line of an edge gets thicker with the speed both ends support.
+ */
+static void setEdgeWidth(TreeLayout *layout, LayoutEdge *edge)
+{
+	TopologyTree *tree = layout->tree;
+
+	edge->lineWidth = (MIN(tree->selfid[edge->node][0].packetZero.phySpeed,
+		tree->selfid[edge->child][0].packetZero.phySpeed)+1)*2;
+}
+
+/*
+ * Add an edge from the center of a node to the center of one of its childs.
+ */
+static void addEdge(TreeLayout *layout, int node, int child,
+	int x1, int y1, int x2, int y2)
+{
+	LayoutEdge *edge = &layout->edges[layout->edgeCount++];
+
+	edge->node = node;
+	edge->child = child;
+	edge->x1 = x1;
+	edge->y1 = y1;
+	edge->x2 = x2;
+	edge->y2 = y2;
+	setEdgeWidth(layout, edge);
+}
+
+/*
+ * The tree is placed with the linear time variant of the Reingold-Tilford
+ * algorithm by Buchheim, Juenger and Leipert: subtrees are laid out bottom
+ * up and pushed apart just as far as their contours require, every parent
+ * is centered above its childs. Positions are in units of one node slot,
+ * the state of the algorithm is kept in arrays indexed by phyID.
+ */
+typedef struct TidyState_t {
+	TopologyTree	*tree;
+	double		prelim[MAX_NODES];
+	double		mod[MAX_NODES];
+	double		shift[MAX_NODES];
+	double		change[MAX_NODES];
+	double		x[MAX_NODES];
+	unsigned char	thread[MAX_NODES];
+	unsigned char	ancestor[MAX_NODES];
+} TidyState;
+
+#define FIRSTCHILD(t, v)	((t)->child[(t)->firstChild[v]])
+#define LASTCHILD(t, v)		((t)->child[(t)->firstChild[v]+(t)->nchilds[v]-1])
+#define NTHCHILD(t, v, i)	((t)->child[(t)->firstChild[v]+(i)])
+/* The sibling left of a node, or NO_NODE */
+#define LEFTSIBLING(t, v)	((t)->childIndex[v] > 1 \
+	? NTHCHILD(t, (t)->parent[v], (t)->childIndex[v]-2) : NO_NODE)
+
+static int nextLeft(TidyState *st, int v)
+{
+	return st->tree->nchilds[v] ? FIRSTCHILD(st->tree, v) : st->thread[v];
+}
+
+static int nextRight(TidyState *st, int v)
+{
+	return st->tree->nchilds[v] ? LASTCHILD(st->tree, v) : st->thread[v];
+}
+
+static void moveSubtree(TidyState *st, int wm, int wp, double shift)
+{
+	int subtrees = st->tree->childIndex[wp] - st->tree->childIndex[wm];
+
+	st->change[wp] -= shift/subtrees;
+	st->shift[wp] += shift;
+	st->change[wm] += shift/subtrees;
+	st->prelim[wp] += shift;
+	st->mod[wp] += shift;
+}
+
+/*
+ * Push the subtree of v right until it does not overlap the subtrees of
+ * its left siblings, and thread the contours for the levels below.
+ * RETURNS:	the new default ancestor
+ */
+static int apportion(TidyState *st, int v, int defaultAncestor)
+{
+	TopologyTree *tree = st->tree;
+	int w = LEFTSIBLING(tree, v);
+	int vip, vop, vim, vom, a;
+	double sip, sop, sim, som, shift;
+
+	if (w == NO_NODE) return defaultAncestor;
+	vip = vop = v;
+	vim = w;
+	vom = FIRSTCHILD(tree, tree->parent[v]);
+	sip = st->mod[vip];
+	sop = st->mod[vop];
+	sim = st->mod[vim];
+	som = st->mod[vom];
+	while (nextRight(st, vim) != NO_NODE && nextLeft(st, vip) != NO_NODE) {
+		vim = nextRight(st, vim);
+		vip = nextLeft(st, vip);
+		vom = nextLeft(st, vom);
+		vop = nextRight(st, vop);
+		st->ancestor[vop] = v;
+		shift = (st->prelim[vim] + sim) - (st->prelim[vip] + sip) + 1;
+		if (shift > 0) {
+			a = st->ancestor[vim];
+			if (tree->parent[a] != tree->parent[v])
+				a = defaultAncestor;
+			moveSubtree(st, a, v, shift);
+			sip += shift;
+			sop += shift;
+		}
+		sim += st->mod[vim];
+		sip += st->mod[vip];
+		som += st->mod[vom];
+		sop += st->mod[vop];
+	}
+	if (nextRight(st, vim) != NO_NODE && nextRight(st, vop) == NO_NODE) {
+		st->thread[vop] = nextRight(st, vim);
+		st->mod[vop] += sim - sop;
+	}
+	if (nextLeft(st, vip) != NO_NODE && nextLeft(st, vom) == NO_NODE) {
+		st->thread[vom] = nextLeft(st, vip);
+		st->mod[vom] += sip - som;
+		defaultAncestor = v;
+	}
+	return defaultAncestor;
+}
+
+static void executeShifts(TidyState *st, int v)
+{
+	TopologyTree *tree = st->tree;
+	double shift = 0, change = 0;
+	int i, w;
+
+	for (i=tree->nchilds[v]-1; i >= 0; i--) {
+		w = NTHCHILD(tree, v, i);
+		st->prelim[w] += shift;
+		st->mod[w] += shift;
+		change += st->change[w];
+		shift += st->shift[w] + change;
+	}
+}
+
+static void firstWalk(TidyState *st, int v)
+{
+	TopologyTree *tree = st->tree;
+	int i, w, defaultAncestor;
+	double midpoint;
+
+	w = LEFTSIBLING(tree, v);
+	if (tree->nchilds[v] == 0) {
+		st->prelim[v] = (w != NO_NODE) ? st->prelim[w] + 1 : 0;
+		return;
+	}
+	defaultAncestor = FIRSTCHILD(tree, v);
+	for (i=0; i < tree->nchilds[v]; i++) {
+		firstWalk(st, NTHCHILD(tree, v, i));
+		defaultAncestor = apportion(st, NTHCHILD(tree, v, i),
+			defaultAncestor);
+	}
+	executeShifts(st, v);
+	midpoint = (st->prelim[FIRSTCHILD(tree, v)]
+		+ st->prelim[LASTCHILD(tree, v)]) / 2;
+	if (w != NO_NODE) {
+		st->prelim[v] = st->prelim[w] + 1;
+		st->mod[v] = st->prelim[v] - midpoint;
+	} else {
+		st->prelim[v] = midpoint;
+	}
+}
+
+static void secondWalk(TidyState *st, int v, double m)
+{
+	int i;
+
+	st->x[v] = st->prelim[v] + m;
+	for (i=0; i < st->tree->nchilds[v]; i++)
+		secondWalk(st, NTHCHILD(st->tree, v, i), m + st->mod[v]);
+}
+
+/*
+ * Turn the positions of a subtree into pixels and add its nodes in
+ * pre-order and its edges to the layout.
+ * IN:		node:	The root node of the subtree
+ * 		left:	pixel position of slot 0
+ * 		slot:	width of one slot in pixels
+ */
+static void placeSubTree(TreeLayout *layout, TidyState *st, int node,
+	double left, int slot)
+{
+	TopologyTree *tree = layout->tree;
+	LayoutNode *ln = &layout->nodes[layout->nodeCount];
+	int cx = (int) (left + st->x[node]*slot) + slot/2;
+	int level = tree->level[node];
+	int i, child;
+
+	layout->nodeIndex[node] = layout->nodeCount++;
+	ln->node = node;
+	ln->x = cx - NODEWIDTH/2;
+	ln->y = level*NODEHEIGHT*2;
+	ln->textX = ln->x;
+	ln->speedY = ln->y + NODEHEIGHT + FONTHEIGHT;
+	ln->labelY = ln->y + NODEHEIGHT + FONTHEIGHT*2;
+	ln->textWidth = 0;
+	chooseNode(layout, ln);
+
+	for (i=0; i < tree->nchilds[node]; i++) {
+		child = NTHCHILD(tree, node, i);
+		addEdge(layout, node, child, cx, ln->y + NODEHEIGHT/2,
+			(int) (left + st->x[child]*slot) + slot/2,
+			(level+1)*NODEHEIGHT*2 + NODEHEIGHT/2);
+		placeSubTree(layout, st, child, left, slot);
+	}
+}
+
+/*
+ * Lay out the whole tree. The slots share the width of the window, but do
+ * not get narrower than LAYOUT_MIN_SLOT; the drawing is then wider than
+ * the window.
+ */
+static void layoutTree(TreeLayout *layout)
+{
+	TopologyTree *tree = layout->tree;
+	TidyState *st;
+	int i, root = topologyTreeRoot(tree);
+	double min, max;
+	int slots, slot;
+
+	if ((st = malloc(sizeof(TidyState))) == NULL)
+		fatal("out of memory!");
+	memset(st, 0, sizeof(TidyState));
+	st->tree = tree;
+	for (i=0; i < MAX_NODES; i++) {
+		st->thread[i] = NO_NODE;
+		st->ancestor[i] = i;
+	}
+	firstWalk(st, root);
+	secondWalk(st, root, -st->prelim[root]);
+
+	min = max = 0;
+	for (i=0; i < tree->nodeCount; i++) {
+		if (st->x[i] < min) min = st->x[i];
+		if (st->x[i] > max) max = st->x[i];
+	}
+	slots = (int) (max - min + 0.5) + 1;
+	slot = layout->width / slots;
+	if (slot < LAYOUT_MIN_SLOT) slot = LAYOUT_MIN_SLOT;
+	layout->extentWidth = slots*slot;
+	layout->extentHeight = (topologyTreeDepth(tree)*2 - 1)*NODEHEIGHT
+		+ FONTHEIGHT*2 + FONTHEIGHT/2;
+
+	/* Center the drawing if it is narrower than the window */
+	placeSubTree(layout, st, root, -min*slot
+		+ MAX(0, (layout->width - layout->extentWidth)/2), slot);
+	free(st);
+}
+
+/*
+ * Sort the node boxes into the cells of the hit-test grid they touch.
+ */
+static void buildGrid(TreeLayout *layout)
+{
+	int i, col, row, cell, cells;
+	unsigned short *start;
+	LayoutNode *ln;
+
+	layout->gridCols = (MAX(layout->width, layout->extentWidth)
+		+ LAYOUT_CELL_WIDTH-1) / LAYOUT_CELL_WIDTH;
+	layout->gridRows = topologyTreeDepth(layout->tree);
+	cells = layout->gridCols * layout->gridRows;
+	free(layout->gridStart);
+	start = layout->gridStart = calloc(cells+1, sizeof(unsigned short));
+	if (start == NULL) fatal("out of memory!");
+
+	/* Count the entries of every cell and sum them up to the cell ends */
+	for (i=0; i < layout->nodeCount; i++) {
+		ln = &layout->nodes[i];
+		row = ln->y / LAYOUT_CELL_HEIGHT;
+		for (col=ln->x / LAYOUT_CELL_WIDTH;
+			col <= (ln->x+NODEWIDTH-1) / LAYOUT_CELL_WIDTH
+			&& col < layout->gridCols; col++)
+			start[row*layout->gridCols+col]++;
+	}
+	for (cell=1; cell <= cells; cell++)
+		start[cell] += start[cell-1];
+
+	/* Fill the cells back to front, leaving start at the cell starts */
+	for (i=layout->nodeCount-1; i >= 0; i--) {
+		ln = &layout->nodes[i];
+		row = ln->y / LAYOUT_CELL_HEIGHT;
+		for (col=ln->x / LAYOUT_CELL_WIDTH;
+			col <= (ln->x+NODEWIDTH-1) / LAYOUT_CELL_WIDTH
+			&& col < layout->gridCols; col++) {
+			cell = row*layout->gridCols+col;
+			layout->gridNodes[--start[cell]] = i;
+		}
+	}
+}
+
+TreeLayout *treeLayoutGet(TopologyTree *tree, int myPhyID, int width,
+	int height)
+{
+	if (layoutValid && layout.tree == tree
+		&& layout.generation == tree->generation
+		&& layout.myPhyID == myPhyID
+		&& layout.width == width && layout.height == height)
+		return &layout;
+
+	DEBUG_GENERAL fprintf(stderr, "Layout for generation %d, %dx%d\n",
+		tree->generation, width, height);
+	initIcons();
+	layout.tree = tree;
+	layout.generation = tree->generation;
+	layout.myPhyID = myPhyID;
+	layout.width = width;
+	layout.height = height;
+	layout.nodeCount = 0;
+	layout.edgeCount = 0;
+	layout.textWidth = 0;
+	layoutTree(&layout);
+	buildGrid(&layout);
+	layoutValid = 1;
+	return &layout;
+}
+
+LayoutNode *treeLayoutUpdateNode(TopologyTree *tree, int node)
+{
+	LayoutNode *ln;
+
+	if (!layoutValid || layout.tree != tree) return NULL;
+	ln = &layout.nodes[layout.nodeIndex[node]];
+	chooseNode(&layout, ln);
+	return ln;
+}
+
+int treeLayoutRebind(TopologyTree *tree, int myPhyID, unsigned char *changed)
+{
+	TopologyTree *old = layout.tree;
+	LayoutNode before, *ln;
+	LayoutEdge *edge;
+	unsigned char dirty[MAX_NODES];
+	int i, width, count = 0;
+
+	if (!layoutValid || layout.myPhyID != myPhyID
+		|| old->nodeCount != tree->nodeCount)
+		goto differs;
+	for (i=0; i < tree->nodeCount; i++) {
+		if (old->parent[i] != tree->parent[i]
+			|| old->childIndex[i] != tree->childIndex[i])
+			goto differs;
+	}
+
+	memset(dirty, 0, sizeof(dirty));
+	layout.tree = tree;
+	layout.generation = tree->generation;
+	for (i=0; i < layout.nodeCount; i++) {
+		ln = &layout.nodes[i];
+		before = *ln;	/* the label still points into the old tree */
+		chooseNode(&layout, ln);
+		if (ln->icon != before.icon || ln->speed != before.speed
+			|| strcmp(ln->label, before.label))
+			dirty[ln->node] = 1;
+	}
+	for (i=0; i < layout.edgeCount; i++) {
+		edge = &layout.edges[i];
+		width = edge->lineWidth;
+		setEdgeWidth(&layout, edge);
+		if (edge->lineWidth != width)
+			dirty[edge->node] = dirty[edge->child] = 1;
+	}
+	for (i=0; i < tree->nodeCount; i++)
+		if (dirty[i]) changed[count++] = i;
+	return count;
+
+differs:
+	layoutValid = 0;
+	return -1;
+}
+
+void treeLayoutInvalidate(void)
+{
+	layoutValid = 0;
+}
+
+int treeLayoutHit(TreeLayout *layout, int x, int y)
+{
+	int i, cell;
+	LayoutNode *ln;
+
+	if (x < 0 || y < 0 || x >= layout->gridCols*LAYOUT_CELL_WIDTH
+		|| y >= layout->gridRows*LAYOUT_CELL_HEIGHT)
+		return -1;
+	cell = (y / LAYOUT_CELL_HEIGHT)*layout->gridCols + x / LAYOUT_CELL_WIDTH;
+	for (i=layout->gridStart[cell]; i < layout->gridStart[cell+1]; i++) {
+		ln = &layout->nodes[layout->gridNodes[i]];
+		if (x > ln->x && x < ln->x + NODEWIDTH
+			&& y > ln->y && y < ln->y + NODEHEIGHT)
+			return ln->node;
+	}
+	return -1;
+}
+
+int treeLayoutVisible(TreeLayout *layout, int x0, int y0, int x1, int y1,
+	unsigned char *nodes)
+{
+	int i, row, col, row0, row1, col0, col1, first, count = 0;
+	LayoutNode *ln;
+
+	/* Look as far left as the widest text reaches */
+	row0 = MAX(y0, 0) / LAYOUT_CELL_HEIGHT;
+	row1 = MIN(y1 / LAYOUT_CELL_HEIGHT, layout->gridRows-1);
+	col0 = MAX(x0 - MAX(LAYOUT_MIN_SLOT, layout->textWidth), 0)
+		/ LAYOUT_CELL_WIDTH;
+	col1 = MIN(x1 / LAYOUT_CELL_WIDTH, layout->gridCols-1);
+	if (x1 < 0 || y1 < 0) return 0;
+
+	for (row=row0; row <= row1; row++) {
+		for (col=col0; col <= col1; col++) {
+			for (i=layout->gridStart[row*layout->gridCols+col];
+				i < layout->gridStart[row*layout->gridCols+col+1];
+				i++) {
+				ln = &layout->nodes[layout->gridNodes[i]];
+				/* A node spanning two cells is taken from the
+				 * first one that is looked at */
+				first = ln->x / LAYOUT_CELL_WIDTH;
+				if (first == col || col == col0)
+					nodes[count++] = layout->gridNodes[i];
+			}
+		}
+	}
+	return count;
+}
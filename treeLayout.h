@@ -0,0 +1,152 @@
+/*
+ * This file is part of the gscanbus project.
+ *
+ * treeLayout.h - cached geometry of the topology drawing
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TREELAYOUT_H__
+#define __TREELAYOUT_H__
+#include "topologyTree.h"
+#include <gtk/gtk.h>
+
+#define FONTHEIGHT 12
+
+#define NODEWIDTH 48	/* Pixmaps should not exceed this size */
+#define NODEHEIGHT 48
+
+#define LAYOUT_MIN_SLOT (NODEWIDTH*2)	/* leaves room for the labels */
+
+/*
+ * Cells of the hit-test grid. Since nodes on a level are at least
+ * LAYOUT_MIN_SLOT apart, a node box touches at most two cells and a cell
+ * holds at most two nodes.
+ */
+#define LAYOUT_CELL_WIDTH LAYOUT_MIN_SLOT
+#define LAYOUT_CELL_HEIGHT (NODEHEIGHT*2)
+
+/*
+ * A node of the drawing. (x, y) is the upper left corner of the
+ * NODEWIDTH x NODEHEIGHT box that holds the icon, the speed and the label
+ * are drawn below it starting at textX.
+ */
+typedef struct LayoutNode_t {
+	int		node;		/* phyID */
+	int		x, y;
+	int		textX, speedY, labelY;
+	int		textWidth;	/* of speed and label as last drawn */
+	int		highlight;	/* the local host controller */
+	GdkPixbuf	*icon;
+	const char	*speed;
+	const char	*label;		/* points into the label pool */
+} LayoutNode;
+
+/*
+ * A connection between the centers of two nodes.
+ */
+typedef struct LayoutEdge_t {
+	int		node, child;	/* phyIDs of the ends */
+	int		x1, y1, x2, y2;
+	int		lineWidth;
+} LayoutEdge;
+
+/*
+ * The layout of a tree for one window size. Nodes are stored in pre-order,
+ * edges in the order they are reached from the root. The extent is the
+ * size of the whole drawing, which may exceed the window for wide or deep
+ * trees. The grid lists the nodes touching each cell, cell (col, row) has
+ * the entries gridStart[row*gridCols+col] .. gridStart[row*gridCols+col+1]-1
+ * of gridNodes.
+ */
+typedef struct TreeLayout_t {
+	TopologyTree	*tree;
+	unsigned int	generation;
+	int		myPhyID;
+	int		width, height;
+	int		extentWidth, extentHeight;
+	int		nodeCount;
+	LayoutNode	nodes[MAX_NODES];
+	unsigned char	nodeIndex[MAX_NODES];	/* phyID -> index in nodes */
+	int		edgeCount;
+	LayoutEdge	edges[MAX_NODES];
+	int		textWidth;	/* of the widest speed or label */
+	int		gridCols, gridRows;
+	unsigned short	*gridStart;
+	unsigned char	gridNodes[MAX_NODES*2];	/* indices into nodes */
+} TreeLayout;
+
+/*
+ * Get the layout of a tree for a window size. The layout is computed only
+ * if the tree, its generation, the host phyID or the size changed since the
+ * last call; the labels of the nodes are set while doing so.
+ * IN:		tree:	the topology tree to draw
+ *		myPhyID: phyID of the local host controller, for highlighting
+ *		width:	width of the drawing area
+ *		height:	height of the drawing area
+ * RETURNS:	the cached layout, valid until the next call
+ */
+TreeLayout *treeLayoutGet(TopologyTree *tree, int myPhyID, int width,
+	int height);
+
+/*
+ * Choose icon and label of a node again after its ROM has changed. The
+ * geometry stays the same.
+ * RETURNS:	the node in the cached layout, NULL if the cached layout is
+ *		not for this tree
+ */
+LayoutNode *treeLayoutUpdateNode(TopologyTree *tree, int node);
+
+/*
+ * Move the cached layout over to a new scan of the same topology, so only
+ * what changed needs to be repainted. Icons, labels and line widths are
+ * chosen again, the geometry is kept. Must be called before the tree of
+ * the cached layout is freed.
+ * IN:		tree:	the new tree
+ *		myPhyID: phyID of the local host controller
+ *		changed: receives the phyIDs of the nodes whose icon, label,
+ *			speed or connecting lines changed, room for MAX_NODES
+ * RETURNS:	the number of changed nodes, or -1 if the topology differs;
+ *		the cached layout is forgotten then
+ */
+int treeLayoutRebind(TopologyTree *tree, int myPhyID, unsigned char *changed);
+
+/*
+ * Forget the cached layout. Must be called before the tree it was made for
+ * is freed, since another tree may be allocated at the same address.
+ */
+void treeLayoutInvalidate(void);
+
+/*
+ * Find the node whose icon box contains a point, using the grid of the
+ * layout, so it is cheap enough for motion events.
+ * RETURNS:	phyID of the node, or -1 if there is none
+ */
+int treeLayoutHit(TreeLayout *layout, int x, int y);
+
+/*
+ * Find the nodes that may be visible in a rectangle of the layout, using
+ * the grid. Nodes whose labels reach into the rectangle from the left are
+ * included as well, as far as the widest label of the layout reaches.
+ * IN:		x0, y0:	upper left corner of the rectangle
+ *		x1, y1:	lower right corner of the rectangle
+ *		nodes:	receives the indices into layout->nodes, room for
+ *			MAX_NODES entries
+ * RETURNS:	the number of nodes found, each is reported once
+ */
+int treeLayoutVisible(TreeLayout *layout, int x0, int y0, int x1, int y1,
+	unsigned char *nodes);
+
+#endif